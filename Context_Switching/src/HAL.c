@@ -3,21 +3,19 @@
  * @date: 2014/01/17
  * NOTE: This file contains embedded assembly. 
  *       The code borrowed some ideas from ARM RL-RTX source code
+ *       Processes run in thread mode on PSP. Handlers and the kernel
+ *       run on MSP, so process stacks only hold one exception frame
+ *       plus R4-R11 while switched out.
  */
- 
-/* pop off exception stack frame from the stack */
-__asm void __rte(void)
-{
-  PRESERVE8            ; 8 bytes alignement of the stack
-  MVN  LR, #:NOT:0xFFFFFFF9  ; set EXC_RETURN value, Thread mode, MSP
-  BX   LR
-}
 
-/* NOTE: assuming MSP is used. Ideally, PSP should be used */
 __asm void SVC_Handler (void) 
 {
   PRESERVE8            ; 8 bytes alignement of the stack
-  MRS  R0, MSP         ; Read MSP
+  IMPORT g_svc_restart
+  TST  LR, #4          ; EXC_RETURN bit 2 tells which stack has the frame
+  ITE  EQ
+  MRSEQ R0, MSP        ; Read MSP, rtx_init is called from main before any process
+  MRSNE R0, PSP        ; Read PSP, called by a process
 	
   
   LDR  R1, [R0, #24]   ; Read Saved PC from SP
@@ -31,20 +29,56 @@ __asm void SVC_Handler (void)
                    
   BNE  SVC_EXIT        ; if SVC Number !=0, exit
  
+  PUSH {R0, LR}        ; Save frame address and EXC_RETURN on the kernel stack
   LDM  R0, {R0-R3, R12}; Read R0-R3, R12 from stack. 
                        ; NOTE R0 contains the sp before this instruction
 
-  PUSH {R4-R11, LR}    ; Save other registers for preemption caused by i-procs
   BLX  R12             ; Call SVC C Function, 
                        ; R12 contains the corresponding 
                        ; C kernel functions entry point
                        ; R0-R3 contains the kernel function input parameter (See AAPCS)
-  POP {R4-R11, LR}     ; Restore other registers for preemption caused by i-procs
-  MRS  R12, MSP        ; Read MSP
-  STR  R0, [R12]       ; store C kernel function return value in R0
+  POP  {R1, LR}        ; R1 <= exception stack frame address
+  LDR  R2, =g_svc_restart
+  LDR  R3, [R2]
+  CMP  R3, #0
+  BNE  SVC_RESTART
+  STR  R0, [R1]        ; store C kernel function return value in R0
                        ; to R0 on the exception stack frame  
+  BX   LR              ; return to the stack/mode given by EXC_RETURN
+
+SVC_RESTART            ; the call blocked, run the SVC instruction again when resumed
+  MOV  R3, #0
+  STR  R3, [R2]        ; g_svc_restart = 0
+  LDR  R0, [R1, #24]
+  SUB  R0, R0, #2      ; saved PC back to the SVC instruction, R0-R3, R12 untouched
+  STR  R0, [R1, #24]
 SVC_EXIT  
-	
-  MVN  LR, #:NOT:0xFFFFFFF9  ; set EXC_RETURN value, Thread mode, MSP
+  BX   LR
+}
+
+/* Deferred context switch requested by the kernel and interrupt handlers
+   (k_release_processor, k_pend_switch). PendSV has the lowest exception
+   priority, so it only runs once every other handler has returned, and any
+   number of requests made in the meantime end up as a single switch.
+   The hardware already stacked R0-R3, R12, LR, PC, xPSR on the process stack,
+   the rest of the context is pushed here. */
+__asm void PendSV_Handler (void)
+{
+  PRESERVE8            ; 8 bytes alignement of the stack
+  IMPORT k_context_switch
+  IMPORT gp_current_process
+  MRS  R0, PSP         ; Read PSP of the current process
+  LDR  R1, =gp_current_process
+  LDR  R1, [R1]
+  CMP  R1, #0          ; no process runs yet when the RTX starts
+  BEQ  PENDSV_SWITCH
+  STMDB R0!, {R4-R11}  ; Save other registers on the process stack
+PENDSV_SWITCH
+  PUSH {R4, LR}        ; R4 keeps the kernel stack 8 bytes aligned
+  BL   k_context_switch; R0 <= PSP of the next process
+  POP  {R4, LR}
+  LDMIA R0!, {R4-R11}  ; Restore other registers of the next process
+  MSR  PSP, R0
+  MVN  LR, #:NOT:0xFFFFFFFD  ; set EXC_RETURN value, Thread mode, PSP
   BX   LR
 }
@@ -0,0 +1,99 @@
+/**
+ * @file:   k_log.c
+ * @brief:  deferred binary logging, see k_log.h
+ */
+
+#include <LPC17xx.h>
+#include "k_log.h"
+#include "uart.h"
+
+extern volatile uint32_t g_timer_count;
+
+/* records, any context reserves a slot with LDREX/STREX on the head */
+LOG_REC g_log_ring[LOG_RING_SIZE];
+volatile uint32_t g_log_head = 0;
+volatile uint32_t g_log_tail = 0;
+uint32_t g_log_dropped = 0;     /* not exact if two contexts drop at once */
+uint32_t g_log_mask = LOG_MASK_DEFAULT;
+
+uint8_t g_log_tx[LOG_TX_SIZE];
+volatile uint32_t g_log_tx_head = 0;
+volatile uint32_t g_log_tx_tail = 0;
+
+const char g_log_hex[] = "0123456789ABCDEF";
+
+/* safe from processes, kernel calls and interrupt handlers */
+void log_write(int id, int nargs, uint32_t a0, uint32_t a1, uint32_t a2) {
+	uint32_t slot;
+	LOG_REC *rec;
+	
+	if (!(g_log_mask & LOG_BIT(id))) {
+		return;
+	}
+	do {
+		slot = __LDREXW(&g_log_head);
+		if (slot - g_log_tail >= LOG_RING_SIZE) {
+			__CLREX();
+			g_log_dropped++;
+			return;
+		}
+	} while (__STREXW(slot + 1, &g_log_head));
+	
+	rec = &g_log_ring[slot & (LOG_RING_SIZE - 1)];
+	rec->time = g_timer_count;
+	rec->id = id;
+	rec->nargs = nargs;
+	rec->args[0] = a0;
+	rec->args[1] = a1;
+	rec->args[2] = a2;
+	__DMB();
+	rec->seq = slot + 1;
+}
+
+void log_hex(uint32_t head, uint32_t value, int digits) {
+	while (digits-- > 0) {
+		g_log_tx[(head + digits) & (LOG_TX_SIZE - 1)] = g_log_hex[value & 0xF];
+		value >>= 4;
+	}
+}
+
+/* encode complete records as "@L<id><nargs><time><args>\r\n" in hex,
+   returns the number of records moved. Only the null process calls it */
+int log_drain(void) {
+	LPC_UART_TypeDef *pUart = (LPC_UART_TypeDef *) LPC_UART0;
+	uint32_t head = g_log_tx_head;
+	int count = 0;
+	
+	while (g_log_tail != g_log_head && LOG_TX_SIZE - (head - g_log_tx_tail) >= LOG_FRAME_MAX) {
+		LOG_REC *rec = &g_log_ring[g_log_tail & (LOG_RING_SIZE - 1)];
+		int i;
+		
+		if (rec->seq != g_log_tail + 1) {
+			break;	// reserved but not written yet
+		}
+		
+		g_log_tx[head++ & (LOG_TX_SIZE - 1)] = '@';
+		g_log_tx[head++ & (LOG_TX_SIZE - 1)] = 'L';
+		log_hex(head, rec->id, 2);
+		head += 2;
+		log_hex(head, rec->nargs, 1);
+		head += 1;
+		log_hex(head, rec->time, 8);
+		head += 8;
+		for (i = 0; i < rec->nargs && i < LOG_MAX_ARGS; i++) {
+			log_hex(head, rec->args[i], 8);
+			head += 8;
+		}
+		g_log_tx[head++ & (LOG_TX_SIZE - 1)] = '\r';
+		g_log_tx[head++ & (LOG_TX_SIZE - 1)] = '\n';
+		
+		g_log_tail++;
+		count++;
+	}
+	
+	if (count > 0) {
+		g_log_tx_head = head;
+		pUart->IER = IER_THRE | IER_RLS | IER_RBR;
+	}
+	return count;
+}
@@ -0,0 +1,55 @@
+/**
+ * @file:   k_log.h
+ * @brief:  deferred binary logging. log_write only stores a format id and raw
+ *          arguments in a RAM ring, the null process encodes the records and
+ *          the UART i-process sends them out as "@L..." lines that
+ *          tools/log_decode.c turns back into text.
+ */
+
+#ifndef K_LOG_H_
+#define K_LOG_H_
+
+#include <stdint.h>
+
+#define LOG_FMT(id, fmt) id,
+typedef enum {
+#include "log_fmt.h"
+	LOG_NUM_FMTS
+} LOG_ID_E;
+#undef LOG_FMT
+
+#define LOG_RING_SIZE 64    /* records, power of 2 */
+#define LOG_TX_SIZE 256     /* bytes of encoded frames, power of 2 */
+#define LOG_MAX_ARGS 3
+#define LOG_FRAME_MAX (2 + 2 + 1 + 8 + 8 * LOG_MAX_ARGS + 2)
+
+/* ids that are logged, one bit per id. Everything is on, scheduling events
+   included: a record is a few stores into the ring and the null process
+   encodes it only when idle. Clear bits from the debugger to quieten the console */
+#define LOG_BIT(id) (1u << (id))
+#define LOG_MASK_DEFAULT (~0u)
+
+typedef struct log_rec {
+	volatile uint32_t seq;      /* slot number + 1 once the record is complete */
+	uint32_t time;              /* g_timer_count when it was logged */
+	uint8_t id;
+	uint8_t nargs;
+	uint32_t args[LOG_MAX_ARGS];
+} LOG_REC;
+
+/* encoded frames, filled by log_drain and sent by the UART i-process */
+extern uint8_t g_log_tx[LOG_TX_SIZE];
+extern volatile uint32_t g_log_tx_head;
+extern volatile uint32_t g_log_tx_tail;
+extern uint32_t g_log_dropped;
+extern uint32_t g_log_mask;
+
+void log_write(int id, int nargs, uint32_t a0, uint32_t a1, uint32_t a2);
+int log_drain(void);
+
+#define LOG0(id)             log_write(id, 0, 0, 0, 0)
+#define LOG1(id, a)          log_write(id, 1, (uint32_t)(a), 0, 0)
+#define LOG2(id, a, b)       log_write(id, 2, (uint32_t)(a), (uint32_t)(b), 0)
+#define LOG3(id, a, b, c)    log_write(id, 3, (uint32_t)(a), (uint32_t)(b), (uint32_t)(c))
+
+#endif /* ! K_LOG_H_ */
@@ -6,7 +6,11 @@
  */
 
 #include "k_memory.h"
+#include "k_process.h"
+#include "k_log.h"
+#include "k_trace.h"
 #include "list.h"
+#include <string.h>
 
 #ifdef DEBUG_0
 #include "printf.h"
@@ -26,8 +30,17 @@ U32 *gp_stack; /* The last allocated stack low address. 8 bytes aligned */
           |    Proc 2 STACK           |
           |---------------------------|<--- gp_stack
           |                           |
-          |        HEAP               |
+          |  STACK HEAP, created      |
+          |  process stacks           |
           |                           |
+          |---------------------------|<--- gp_heap_start
+          |  512 B blocks             |
+          |---------------------------|
+          |  128 B blocks, what fits  |
+          |---------------------------|
+          |  48 B, 16 B blocks        |
+          |---------------------------|
+          |  per slot arrays          |
           |---------------------------|
           |        PCB 2              |
           |---------------------------|
@@ -45,26 +58,195 @@ U32 *gp_stack; /* The last allocated stack low address. 8 bytes aligned */
 
 */
 
-//const int NUM_MEM_BLOCKS = 60;
-const int MEM_BLOCK_SIZE = 128;
+const U32 g_slab_sizes[SLAB_CLASSES] = {SLAB_TINY_SIZE, SLAB_SMALL_SIZE, SLAB_BLOCK_SIZE, SLAB_LARGE_SIZE};
+const int g_slab_counts[SLAB_CLASSES] = {SLAB_TINY_COUNT, SLAB_SMALL_COUNT, 0, SLAB_LARGE_COUNT}; // 128 byte blocks are sized at boot
+const int g_slab_irq_reserve[SLAB_CLASSES] = {IPROC_RESERVE_PROXIES, 0, IPROC_RESERVE_BLOCKS, 0};
+
+/* per slot (block) of every class, g_slab_slots entries carved by memory_init */
+int g_slab_slots = 0;
+int *flag; // owner pid, 0 is ununsed memory block
+U8 *g_block_refs; // extra holders of a shared block
+U16 *g_slab_asked; // bytes requested for a block in use
+int *g_slab_next; // next free slot of a free block
+U8 *g_slab_charge; // pid that requested a block in use, its quota is charged.
+                   // Unlike flag[] it does not follow the block to its receivers
 
-const int MEM_BLOCK_SIZE_ENV = 40;
-int flag_env[NUM_MEM_BLOCKS] = {0}; // 0 is ununsed memory block
-void* memory_env[NUM_MEM_BLOCKS] = {0};
+/* holders of shared blocks, so exit_process drops only the references of the
+   exiting process. g_share_refs counts the references they hold, there are
+   never more holders than references, so entries run out only past SHARE_REFS_MAX */
+SHARE_HOLDER g_share_holders[SHARE_REFS_MAX];
+int g_share_refs = 0;
 
-void* memory[NUM_MEM_BLOCKS] = {0}; // addresses of available memory
-int flag[NUM_MEM_BLOCKS] = {0}; // 0 is ununsed memory block
+/* 128 byte blocks still owed to the reservations, sum of mem_reserve_left */
+int g_mem_reserve_left = 0;
 
+SLAB_CLASS g_slab[SLAB_CLASSES];
+
+/* RAM between the pools and the static stacks, for stacks of created processes.
+   Free ranges are sorted by address and never touch each other */
+U8 *gp_heap_start;
+STACK_RANGE g_stack_free[MAX_DYN_PROCS + 1];
+int g_stack_free_count = 0;
 
 /* Debug variable to keep track of memory leaks */
 int memory_block_count = 0;
 
 extern PCB *gp_current_process;
 
+/* take the first free slot of a class, -1 if there is none */
+int slab_pop(SLAB_CLASS *slab) {
+	int slot = slab->free_head;
+	int used;
+	
+	if (slot == -1) {
+		return -1;
+	}
+	slab->free_head = g_slab_next[slot];
+	slab->free_count--;
+	
+	used = slab->count - slab->free_count;
+	if (used > slab->used_max) {
+		slab->used_max = used;
+	}
+	return slot;
+}
+
+/* put a slot back on the free list of its class */
+void slab_push(SLAB_CLASS *slab, int slot) {
+	g_slab_next[slot] = slab->free_head;
+	slab->free_head = slot;
+	slab->free_count++;
+}
+
+/* smallest class a request of size bytes fits in, -1 if it is too large */
+int slab_class_of(U32 size) {
+	int c;
+	
+	for (c = 0; c < SLAB_CLASSES; c++) {
+		if (size <= g_slab_sizes[c]) {
+			return c;
+		}
+	}
+	return -1;
+}
+
+/* slot of the block starting at p, -1 if p is not a block */
+int slab_slot(void *p, int *p_class) {
+	U8 *hdr = (U8 *)MSG_HDR(p);
+	int c;
+	
+	for (c = 0; c < SLAB_CLASSES; c++) {
+		SLAB_CLASS *slab = &g_slab[c];
+		U32 stride = slab->block_size + SLAB_HDR_SIZE;
+		
+		if (hdr >= slab->base && hdr < slab->base + slab->count * stride) {
+			if ((hdr - slab->base) % stride != 0) {
+				return -1;
+			}
+			*p_class = c;
+			return slab->first + (hdr - slab->base) / stride;
+		}
+	}
+	return -1;
+}
+
+/* address of the block in a slot of class c, past its header */
+void *slab_addr(int c, int slot) {
+	return g_slab[c].base + (slot - g_slab[c].first) * (g_slab[c].block_size + SLAB_HDR_SIZE) + SLAB_HDR_SIZE;
+}
+
+/* entry of pid for the shared block in slot, of any holder if pid is -1. NULL if there is none */
+SHARE_HOLDER *share_holder(int slot, int pid) {
+	int i;
+	
+	for (i = 0; i < SHARE_REFS_MAX; i++) {
+		SHARE_HOLDER *p_holder = &g_share_holders[i];
+		
+		if (p_holder->count > 0 && p_holder->slot == slot && (pid == -1 || p_holder->pid == pid)) {
+			return p_holder;
+		}
+	}
+	return NULL;
+}
+
+/* n more references of the shared block in slot for pid */
+void share_hold(int slot, int pid, int n) {
+	SHARE_HOLDER *p_holder = share_holder(slot, pid);
+	int i;
+	
+	for (i = 0; p_holder == NULL && i < SHARE_REFS_MAX; i++) {
+		if (g_share_holders[i].count == 0) {
+			p_holder = &g_share_holders[i];
+			p_holder->slot = slot;
+			p_holder->pid = pid;
+		}
+	}
+	p_holder->count += n;
+}
+
+/* one reference less for pid, or for some holder if pid has none (e.g. dropped by the kernel) */
+void share_unhold(int slot, int pid) {
+	SHARE_HOLDER *p_holder = share_holder(slot, pid);
+	
+	if (p_holder == NULL) {
+		p_holder = share_holder(slot, -1);
+	}
+	if (p_holder != NULL) {
+		p_holder->count--;
+	}
+}
+
+/* part of its reservation a process does not hold yet */
+int mem_reserve_left(PCB *p_pcb) {
+	return p_pcb->m_mem_block < p_pcb->m_mem_reserve ? p_pcb->m_mem_reserve - p_pcb->m_mem_block : 0;
+}
+
+/* add delta blocks of class c to what pid is charged with */
+void mem_charge(int pid, int c, int delta) {
+	PCB *p_pcb = gp_pcbs[pid];
+	
+	p_pcb->m_stats.mem_used += delta;
+	if (p_pcb->m_stats.mem_used > p_pcb->m_stats.mem_used_max) {
+		p_pcb->m_stats.mem_used_max = p_pcb->m_stats.mem_used;
+	}
+	if (c == SLAB_BLOCK) {
+		g_mem_reserve_left -= mem_reserve_left(p_pcb);
+		p_pcb->m_mem_block += delta;
+		g_mem_reserve_left += mem_reserve_left(p_pcb);
+	}
+}
+
+/* 1 if a request of p_pcb for class c can be served now. i-processes may take
+   any free block. Others must be below their quota and leave the i-process
+   reserve, and for 128 byte blocks what other reservations are owed, alone */
+int k_mem_admits(PCB *p_pcb, int c) {
+	int held = g_slab[c].irq_reserve;
+	
+	if (IS_IPROC(p_pcb->m_pid)) {
+		return g_slab[c].free_count > 0;
+	}
+	if (p_pcb->m_mem_quota > 0 && (int)p_pcb->m_stats.mem_used >= p_pcb->m_mem_quota) {
+		return 0;
+	}
+	if (c == SLAB_BLOCK) {
+		held += g_mem_reserve_left - mem_reserve_left(p_pcb);
+	}
+	return g_slab[c].free_count > held;
+}
 
 void memory_init(void)
 {
-	U8 *p_end = (U8 *)&Image$$RW_IRAM1$$ZI$$Limit;
+	U8 *p_image = (U8 *)&Image$$RW_IRAM1$$ZI$$Limit;
+	U8 *p_end = p_image;
+	U8 *p_pools;
+	U8 *p_limit;
+	U32 stacks;
+	int fixed = 0;
+	int slots = 0;
+	int avail;
+	int blocks;
+	int first = 0;
+	int c;
 	int i;
   
 	/* 4 bytes padding */
@@ -72,9 +254,9 @@ void memory_init(void)
 
 	/* allocate memory for pcb pointers   */
 	gp_pcbs = (PCB **)p_end;
-	p_end += (NUM_PROCS) * sizeof(PCB *);
+	p_end += (MAX_PROCS) * sizeof(PCB *);
   
-	for ( i = 0; i < NUM_PROCS; i++ ) {
+	for ( i = 0; i < MAX_PROCS; i++ ) {
 		gp_pcbs[i] = (PCB *)p_end;
 		gp_pcbs[i]->head = NULL;
 		gp_pcbs[i]->tail = NULL;
@@ -89,31 +271,162 @@ void memory_init(void)
 		--gp_stack; 
 	}
 
-	/* Fixed sized memory pool*/
-	for (i = 0; i < NUM_MEM_BLOCKS; i++) {
-		flag[i] = 0;
+	/* size the pools from the RAM that is really free: the static stacks and
+	   the stack heap come off the top, the fixed classes and the per slot
+	   arrays off the bottom, the 128 byte class gets the rest */
+	stacks = proc_stack_total();
+	p_limit = (U8 *)gp_stack - stacks - STACK_HEAP_SIZE;
+	for (c = 0; c < SLAB_CLASSES; c++) {
+		if (c != SLAB_BLOCK) {
+			fixed += g_slab_counts[c] * (int)(g_slab_sizes[c] + SLAB_HDR_SIZE);
+			slots += g_slab_counts[c];
+		}
+	}
+	avail = (int)(p_limit - p_end) - fixed - slots * (int)SLAB_SLOT_META;
+	blocks = avail > 0 ? avail / (int)(SLAB_BLOCK_SIZE + SLAB_HDR_SIZE + SLAB_SLOT_META) : 0;
+	if (blocks < NUM_MEM_BLOCKS) {
+		printf("Only %d memory blocks fit, %d expected \r\n", blocks, NUM_MEM_BLOCKS);
+	}
+	
+	/* per slot arrays, ints first so every array stays aligned */
+	g_slab_slots = slots + blocks;
+	flag = (int *)p_end;
+	p_end += g_slab_slots * sizeof(int);
+	g_slab_next = (int *)p_end;
+	p_end += g_slab_slots * sizeof(int);
+	g_slab_asked = (U16 *)p_end;
+	p_end += g_slab_slots * sizeof(U16);
+	g_block_refs = p_end;
+	p_end += g_slab_slots;
+	g_slab_charge = p_end;
+	p_end += g_slab_slots;
+	memset(flag, 0, p_end - (U8 *)flag);
+	p_pools = p_end;
+
+	/* one run of fixed size blocks per class */
+	for (c = 0; c < SLAB_CLASSES; c++) {
+		SLAB_CLASS *slab = &g_slab[c];
 		
-		if ((void*)(p_end + i*MEM_BLOCK_SIZE) > gp_stack) {
-			printf("Trying to allocate too much memory \r\n");
-			break;	
+		memset(slab, 0, sizeof(SLAB_CLASS));
+		slab->block_size = g_slab_sizes[c];
+		slab->base = p_end;
+		slab->first = first;
+		slab->count = (c == SLAB_BLOCK) ? blocks : g_slab_counts[c];
+		slab->free_head = -1;
+		slab->irq_reserve = g_slab_irq_reserve[c];
+		p_end += slab->count * (SLAB_HDR_SIZE + slab->block_size);
+		//push in reverse so blocks are handed out lowest address first
+		for (i = slab->count - 1; i >= 0; i--) {
+			slab_push(slab, first + i);
 		}
-		else {
-			memory[i] = (void *) (p_end + i*MEM_BLOCK_SIZE);
+		first += slab->count;
+	}
+	memory_block_count = g_slab[SLAB_BLOCK].free_count;
+	gp_heap_start = p_end;
+	
+	/* RAM budget in bytes, the slack below STACK_HEAP_SIZE goes to the stack heap too */
+	printf("RAM %d: image %d, pcbs %d, slab arrays %d, pools %d, stacks %d, stack heap %d + slack %d \r\n",
+		RAM_END_ADDR - RAM_START_ADDR, p_image - (U8 *)RAM_START_ADDR, (U8 *)flag - p_image,
+		p_pools - (U8 *)flag, p_end - p_pools, stacks, STACK_HEAP_SIZE, p_limit - p_end);
+	printf("pools:");
+	for (c = 0; c < SLAB_CLASSES; c++) {
+		printf(" %d x %d B", g_slab[c].count, g_slab[c].block_size);
+	}
+	printf(" \r\n");
+}
+
+/**
+ * @brief: number of blocks in the pool that serves requests of size bytes
+ * @return: RTX_ERR if size is larger than the largest class
+ */
+int k_pool_capacity(int size)
+{
+	int c;
+	
+	if (size < 0) {
+		return RTX_ERR;
+	}
+	c = slab_class_of(size);
+	if (c == -1) {
+		return RTX_ERR;
+	}
+	return g_slab[c].count;
+}
+
+/**
+ * @brief: hand the RAM still free below the static stacks to stack_alloc
+ * PRE: all static stacks are allocated
+ */
+void stack_heap_init(void)
+{
+	U8 *start = (U8 *)(((U32)gp_heap_start + 7) & ~7);
+	
+	g_stack_free_count = 0;
+	if (start < (U8 *)gp_stack) {
+		g_stack_free[0].start = start;
+		g_stack_free[0].size = (U8 *)gp_stack - start;
+		g_stack_free_count = 1;
+	}
+}
+
+/**
+ * @brief: first fit stack of size_b bytes (a multiple of 8) from the stack heap
+ * @return: the top of the stack, NULL if no free range is large enough
+ */
+U32 *stack_alloc(U32 size_b)
+{
+	int i;
+	
+	for (i = 0; i < g_stack_free_count; i++) {
+		if (g_stack_free[i].size >= size_b) {
+			g_stack_free[i].size -= size_b;
+			if (g_stack_free[i].size == 0) {
+				//range used up, close the gap
+				U8 *top = g_stack_free[i].start + size_b;
+				for (; i < g_stack_free_count - 1; i++) {
+					g_stack_free[i] = g_stack_free[i + 1];
+				}
+				g_stack_free_count--;
+				return (U32 *)top;
+			}
+			return (U32 *)(g_stack_free[i].start + g_stack_free[i].size + size_b);
 		}
 	}
+	return NULL;
+}
+
+/**
+ * @brief: give back a stack from stack_alloc, merging it with its neighbours
+ */
+void stack_free(U32 *sp, U32 size_b)
+{
+	U8 *start = (U8 *)sp - size_b;
+	int i;
+	int j;
 	
-	//memory for envelopes
-	for (i = 0; i < NUM_MEM_BLOCKS; i++) {
-		flag_env[i] = 0;
-		
-		if ((void*)(p_end + i*MEM_BLOCK_SIZE_ENV + MEM_BLOCK_SIZE * NUM_MEM_BLOCKS) > gp_stack) {
-			printf("Trying to allocate too much memory ENVELOPES \r\n");
-			break;	
+	//first range above the freed one
+	for (i = 0; i < g_stack_free_count && g_stack_free[i].start < start; i++);
+	
+	if (i > 0 && g_stack_free[i - 1].start + g_stack_free[i - 1].size == start) {
+		g_stack_free[i - 1].size += size_b;
+		if (i < g_stack_free_count && start + size_b == g_stack_free[i].start) {
+			g_stack_free[i - 1].size += g_stack_free[i].size;
+			for (j = i; j < g_stack_free_count - 1; j++) {
+				g_stack_free[j] = g_stack_free[j + 1];
+			}
+			g_stack_free_count--;
 		}
-		else {
-			memory_env[i] = (void *) (MEM_BLOCK_SIZE * NUM_MEM_BLOCKS + p_end + i*MEM_BLOCK_SIZE_ENV);
+	} else if (i < g_stack_free_count && start + size_b == g_stack_free[i].start) {
+		g_stack_free[i].start = start;
+		g_stack_free[i].size += size_b;
+	} else {
+		for (j = g_stack_free_count; j > i; j--) {
+			g_stack_free[j] = g_stack_free[j - 1];
 		}
-	}	
+		g_stack_free[i].start = start;
+		g_stack_free[i].size = size_b;
+		g_stack_free_count++;
+	}
 }
 
 /**
@@ -140,94 +453,101 @@ U32 *alloc_stack(U32 size_b)
 
 /*
 	while memory is not avaliable, add current process to 
-	blocked queue and release processor
+	blocked queue and release processor. The request is
+	issued again once the process is unblocked
 */
-
-void *k_request_memory_block(void) {
-	int i, j;
-	int available = 0;
+void *slab_request(U32 size) {
+	SLAB_CLASS *slab;
+	PCB *p_pcb = gp_current_process;
+	void *p_blk;
+	int c;
+	int slot = -1;
+	int wait;
+	
+	c = slab_class_of(size);
+	if (c == -1) {
+		return NULL;
+	}
+	slab = &g_slab[c];
 
 	atomic_on();
 	
-	while (!available) {
-		//check for if there is available memory
-		for (i = 0; i < NUM_MEM_BLOCKS; i++) {	
-			// available
-			if (flag[i] == 0) {
-				available = 1;
-				break;
-			}
+	wait = c;
+	if (k_mem_admits(p_pcb, c)) {
+		if (IS_IPROC(p_pcb->m_pid) && slab->free_count <= slab->irq_reserve) {
+			slab->irq_hits++;
 		}
-		
-		//if there is no memory, add current process to blocked queue, and release processor
-		if (!available && gp_current_process->m_pid != PID_UART_IPROC) {
-			gp_current_process->m_state = BLOCKED;
-			addBlockedQ(gp_current_process->m_pid, gp_current_process->m_priority);	
-			atomic_off();			
-			k_release_processor();		
-			atomic_on();
-		} else if (!available && gp_current_process->m_pid == PID_UART_IPROC) {
-			atomic_off();
-			return NULL;
+		slot = slab_pop(slab);
+	} else if (slab->free_count > 0) {
+		//at its quota, or the free blocks are reserved for others
+		if (p_pcb->m_mem_quota > 0 && (int)p_pcb->m_stats.mem_used >= p_pcb->m_mem_quota) {
+			p_pcb->m_stats.quota_hits++;
+			wait = SLAB_WAIT_QUOTA;
 		}
 	}
 	
-	flag[i] = gp_current_process->m_pid;
+	//if there is no memory, add current process to blocked queue, and release processor
+	if (slot == -1 && !IS_IPROC(p_pcb->m_pid)) {
+		p_pcb->m_state = BLOCKED;
+		p_pcb->m_wait_slab = wait;
+		addBlockedQ(p_pcb->m_pid, p_pcb->m_priority);	
+		slab->blocked++;
+		LOG1(LOG_MEM_BLOCKED, p_pcb->m_pid);
+		atomic_off();			
+		k_restart_call();
+		k_release_processor();		
+		return NULL;
+	} else if (slot == -1) {
+		slab->irq_exhausted++;
+		slab->failures++;
+		LOG1(LOG_MEM_FAILED, p_pcb->m_pid);
+		atomic_off();
+		return NULL;
+	}
+	
+	flag[slot] = p_pcb->m_pid;
+	g_slab_charge[slot] = p_pcb->m_pid;
+	mem_charge(p_pcb->m_pid, c, 1);
+	g_slab_asked[slot] = size;
+	slab->waste += slab->block_size - size;
+	if (slab->waste > slab->waste_max) {
+		slab->waste_max = slab->waste;
+	}
+	memory_block_count = g_slab[SLAB_BLOCK].free_count;
+	TRACE(TRACE_ALLOC, p_pcb->m_pid, slot);
+	p_blk = slab_addr(c, slot);
+	MSG_HDR(p_blk)->dest_pid = -1;
 	
 	atomic_off();
-
-	//printf("------------------------------\r\n");	
-	memory_block_count = 0;
-	for (j = 0; j < NUM_MEM_BLOCKS; j++) {
-		if (flag[j] == 0)
-			memory_block_count++;
-		else {
-			//printf("%d has a memory block\r\n", flag[j]);
-		}
-	}
-	//printf("------------------------------\r\n");
 	
-	return memory[i];	
+	return p_blk;
 }
 
+/**
+ * @brief: a block of at least size bytes from the smallest class it fits in
+ * @return: NULL if size is larger than the largest class
+ */
+void *k_request_memory(int size) {
+	if (size < 0) {
+		return NULL;
+	}
+	return slab_request(size);
+}
 
-/** 
-requests memory for envelope
-**/
-void* k_request_memory_env(void) {
-	int i, j;
-	int available = 0;
+void *k_request_memory_block(void) {
+	return slab_request(SLAB_BLOCK_SIZE);
+}
 
-	atomic_on();
+/**
+ * @brief: mtext bytes of the block p_msg, MTEXT_SIZE for a 128 byte block
+ */
+int k_mtext_size(void *p_msg) {
+	int c;
 	
-	while (!available) {
-		//check for if there is available memory
-		for (i = 0; i < NUM_MEM_BLOCKS; i++) {	
-			// available
-			if (flag_env[i] == 0) {
-				available = 1;
-				break;
-			}
-		}
-		
-		//if there is no memory, add current process to blocked queue, and release processor
-		if (!available && gp_current_process->m_pid != PID_UART_IPROC) {
-			gp_current_process->m_state = BLOCKED_ON_ENV;
-			addBlockedQ(gp_current_process->m_pid, gp_current_process->m_priority);	
-			atomic_off();			
-			k_release_processor();		
-			atomic_on();
-		} else if (!available && gp_current_process->m_pid == PID_UART_IPROC) {
-			atomic_off();
-			return NULL;
-		}
+	if (slab_slot(p_msg, &c) == -1) {
+		return MTEXT_SIZE;
 	}
-	
-	flag_env[i] = gp_current_process->m_pid;
-	
-	atomic_off();
-	
-	return memory_env[i];	
+	return g_slab[c].block_size - sizeof(int);
 }
 
 /*
@@ -235,116 +555,253 @@ void* k_request_memory_env(void) {
 	and remove first element in block queue and put it into ready queue
 */
 int k_release_memory_block(void *p_mem_blk) {
+	SLAB_CLASS *slab;
+	int woken = 0;
 	int pid;
-	int j;
-	int index;
+	int slot;
+	int c;
 	
 	atomic_on();
 
-	// get index of flag array from pointer
-	index = ((char*)p_mem_blk - (char*)memory[0]) / MEM_BLOCK_SIZE;
+	// get slot of flag array from pointer
+	slot = slab_slot(p_mem_blk, &c);
 	
-	// if index is invalid, return
-	if (index >= NUM_MEM_BLOCKS || index < 0) {
+	// if slot is invalid, return
+	if (slot == -1) {
 		atomic_off();
 		return RTX_ERR;
 	}
+	slab = &g_slab[c];
 	
-	//set flag array to be avaliable for block at index or if it doesn't belong to the process
-	if (flag[index] == 0) { //|| flag[index] != gp_current_process->m_pid) {
+	//set flag array to be avaliable for block at slot or if it doesn't belong to the process
+	if (flag[slot] == 0) { //|| flag[slot] != gp_current_process->m_pid) {
 		atomic_off();
 		return RTX_ERR;
+	} else if (g_block_refs[slot] > 0) {
+		//shared block, only the last holder frees it
+		share_unhold(slot, gp_current_process->m_pid);
+		g_share_refs--;
+		if (--g_block_refs[slot] == 0) {
+			//one holder left, the block is an ordinary one again
+			SHARE_HOLDER *p_last = share_holder(slot, -1);
+			
+			if (p_last != NULL) {
+				flag[slot] = p_last->pid;
+				p_last->count = 0;
+			}
+			g_share_refs--;
+		}
+		atomic_off();
+		return RTX_OK;
 	} else {
-		flag[index] = 0;
+		flag[slot] = 0;
 	}
+	slab->waste -= slab->block_size - g_slab_asked[slot];
+	slab_push(slab, slot);
+	memory_block_count = g_slab[SLAB_BLOCK].free_count;
+	TRACE(TRACE_FREE, gp_current_process->m_pid, slot);
 	
+	//back under its quota, retry the request it is blocked in
+	pid = g_slab_charge[slot];
+	g_slab_charge[slot] = 0;
+	if (pid != 0) {
+		mem_charge(pid, c, -1);
+		if (gp_pcbs[pid]->m_state == BLOCKED && gp_pcbs[pid]->m_wait_slab == SLAB_WAIT_QUOTA
+				&& (int)gp_pcbs[pid]->m_stats.mem_used < gp_pcbs[pid]->m_mem_quota) {
+			removeBlockedQ(pid);
+			gp_pcbs[pid]->m_state = RDY;
+			k_unblocked(gp_pcbs[pid]);
+			addQ(pid, gp_pcbs[pid]->m_priority);
+			woken = 1;
+		}
+	}
 	
-	//remove first process in blockedQ, and check for preemption
-	pid = popBlockedQ();
+	//first process in blockedQ the block can go to, and check for preemption
+	pid = popBlockedQ(c);
 	if (pid != -1) {
-		int qPid;
-		
 		gp_pcbs[pid]->m_state = RDY;
+		k_unblocked(gp_pcbs[pid]);
 		addQ(pid, gp_pcbs[pid]->m_priority);
-		/*
-		qPid = peekQ();
-		if(qPid != -1) {
-			//if current process has a lower priority than next process in queue
-			//not 0 is highest prioty, a>b means a has a LOWER priority
-			if(gp_current_process->m_priority > (gp_pcbs[qPid])->m_priority) {
-				k_release_processor();
-			}
-		} */
-		atomic_off();
-		if (gp_current_process->m_pid != PID_UART_IPROC && gp_current_process->m_pid != PID_CLOCK) {
-			k_release_processor();
-		}
-		atomic_on();
-
+		woken = 1;
+	}
+	if (woken) {
+		k_check_preemption();
 	}
 	
 	atomic_off();
 	
-	//printf("------------------------------\r\n");
-	memory_block_count = 0;
-	for (j = 0; j < NUM_MEM_BLOCKS; j++) {
-		if (flag[j] == 0)
-			memory_block_count++;
-		else {
-			//printf("%d has a memory block\r\n", flag[j]);
-		}
+	return RTX_OK;
+}
+
+/*
+	header to queue the block p_msg to pid with, filled in by the caller.
+	Normally the one in front of the block. A block that is already queued,
+	e.g. shared with several receivers, gets a proxy: a tiny block of its own
+	owned by pid, whose header points at p_msg.
+	NULL if p_msg is not a block, or if the proxy request blocked
+*/
+MSG_T *k_msg_header(void *p_msg, int pid) {
+	MSG_T *p_hdr;
+	void *p_proxy;
+	int slot;
+	int c;
+	
+	atomic_on();
+	slot = slab_slot(p_msg, &c);
+	if (slot == -1 || flag[slot] == 0) {
+		atomic_off();
+		return NULL;
 	}
-	//printf("------------------------------\r\n");
+	p_hdr = MSG_HDR(p_msg);
+	if (p_hdr->dest_pid == -1) {
+		p_hdr->msg = p_msg;
+		p_hdr->dest_pid = pid;
+		atomic_off();
+		return p_hdr;
+	}
+	atomic_off();
 	
-	return RTX_OK;
+	p_proxy = slab_request(0);
+	if (p_proxy == NULL) {
+		return NULL;
+	}
+	k_block_owner(p_proxy, pid);
+	p_hdr = MSG_HDR(p_proxy);
+	p_hdr->msg = p_msg;
+	p_hdr->dest_pid = pid;
+	return p_hdr;
+}
+
+/*
+	a header taken off a mailbox: free it for the next send, or release
+	it if it was a proxy. Returns the block it carried
+*/
+void *k_msg_received(MSG_T *p_hdr) {
+	void *p_msg = p_hdr->msg;
+	
+	if (p_msg != MSG_DATA(p_hdr)) {
+		k_release_memory_block(MSG_DATA(p_hdr));
+	} else {
+		p_hdr->dest_pid = -1;
+	}
+	return p_msg;
+}
+
+/*
+	release a message nobody will receive, with its proxy if it has one
+*/
+void k_msg_drop(MSG_T *p_hdr) {
+	k_release_memory_block(k_msg_received(p_hdr));
 }
 
 
 /*
-	release env memory
+	record pid as the holder of a block that is sent to it, so exit_process
+	knows which blocks to take back. A shared block moves one reference from
+	the sender to pid. Pointers outside the pool are ignored
 */
-int k_release_memory_env(void *p_mem_blk) {
-	int pid;
-	int j;
-	int index;
+void k_block_owner(void *p_mem_blk, int pid) {
+	int c;
+	int slot = slab_slot(p_mem_blk, &c);
+	
+	if (slot != -1 && flag[slot] != 0) {
+		if (g_block_refs[slot] > 0) {
+			share_unhold(slot, gp_current_process->m_pid);
+			share_hold(slot, pid, 1);
+		}
+		flag[slot] = pid;
+	}
+}
+
+/*
+	1 if p_msg is an allocated block pid holds, as its only holder or as one
+	of the holders of a shared block. For the sends that skip k_msg_header
+*/
+int k_msg_held(void *p_msg, int pid) {
+	int c;
+	int held = 0;
+	int slot;
 	
 	atomic_on();
+	slot = slab_slot(p_msg, &c);
+	if (slot != -1 && flag[slot] != 0) {
+		if (g_block_refs[slot] > 0) {
+			held = share_holder(slot, pid) != NULL;
+		} else {
+			held = flag[slot] == pid;
+		}
+	}
+	atomic_off();
+	return held;
+}
 
-	// get index of flag array from pointer
-	index = ((char*)p_mem_blk - (char*)memory_env[0]) / MEM_BLOCK_SIZE_ENV;
+/*
+	release every block pid holds, for exit_process.
+	PRE: pid is the current process, the releases are its own
+*/
+void k_release_owned_blocks(int pid) {
+	int c;
+	int i;
 	
-	// if index is invalid, return
-	if (index >= NUM_MEM_BLOCKS || index < 0) {
-		atomic_off();
-		return RTX_ERR;
+	for (c = 0; c < SLAB_CLASSES; c++) {
+		for (i = g_slab[c].first; i < g_slab[c].first + g_slab[c].count; i++) {
+			//of a shared block only its own references, the other holders keep theirs
+			while (g_block_refs[i] > 0 && share_holder(i, pid) != NULL) {
+				k_release_memory_block(slab_addr(c, i));
+			}
+			if (g_block_refs[i] == 0 && flag[i] == pid) {
+				k_release_memory_block(slab_addr(c, i));
+			}
+		}
 	}
+}
+
+/*
+	blocks pid requested stop counting against it, for exit_process.
+	The ones it sent away are released by their receivers
+*/
+void k_uncharge_blocks(int pid) {
+	int c;
+	int i;
 	
-	//set flag array to be avaliable for block at index or if it doesn't belong to the process
-	if (flag_env[index] == 0) { //|| flag[index] != gp_current_process->m_pid) {
-		atomic_off();
-		return RTX_ERR;
-	} else {
-		flag_env[index] = 0;
+	for (c = 0; c < SLAB_CLASSES; c++) {
+		for (i = g_slab[c].first; i < g_slab[c].first + g_slab[c].count; i++) {
+			if (g_slab_charge[i] == pid) {
+				g_slab_charge[i] = 0;
+				mem_charge(pid, c, -1);
+			}
+		}
 	}
+}
+
+/*
+	hand out n more references to a block, so the same payload can be sent
+	to n more receivers. Each receiver releases it, the last one frees it.
+	Shared blocks are read-only for the receivers. Fails while more than
+	SHARE_REFS_MAX references of shared blocks would be out
+*/
+int k_share_memory_block(void *p_mem_blk, int n) {
+	int slot;
+	int c;
 	
+	atomic_on();
 	
-	//remove first process in blockedQ, and check for preemption
-	pid = popBlockedEnvQ();
-	if (pid != -1) {
-		int qPid;
-		
-		gp_pcbs[pid]->m_state = RDY;
-		addQ(pid, gp_pcbs[pid]->m_priority);
-		
+	slot = slab_slot(p_mem_blk, &c);
+	if (slot == -1 || flag[slot] == 0 || n < 0 || g_block_refs[slot] + n > 255
+			|| g_share_refs + n + (g_block_refs[slot] == 0) > SHARE_REFS_MAX) {
 		atomic_off();
-		if (gp_current_process->m_pid != PID_UART_IPROC && gp_current_process->m_pid != PID_CLOCK) {
-			k_release_processor();
-		}
-		atomic_on();
-
+		return RTX_ERR;
+	}
+	if (n > 0) {
+		//the caller holds the new references, and the one it had if the block was not shared yet
+		int held = g_block_refs[slot] == 0 ? n + 1 : n;
+		
+		share_hold(slot, gp_current_process->m_pid, held);
+		g_share_refs += held;
 	}
+	g_block_refs[slot] += n;
 	
 	atomic_off();
-
+	
 	return RTX_OK;
 }
@@ -11,18 +11,109 @@
 #include "k_rtx.h"
 
 /* ----- Definitions ----- */
+#define RAM_START_ADDR 0x10000000
 #define RAM_END_ADDR 0x10008000
 
+/* slab size classes, smallest first. A request is served from the smallest class
+   it fits in. Every block is preceded by a hidden MSG_T header, so sizes are
+   what the process gets and a block takes block_size + SLAB_HDR_SIZE of RAM */
+#define SLAB_CLASSES 4
+#define SLAB_TINY 0                 /* proxy headers of shared blocks, see k_msg_header */
+#define SLAB_SMALL 1                /* a MSG_BUF with its 32 byte mtext */
+#define SLAB_BLOCK 2                /* request_memory_block */
+#define SLAB_LARGE 3
+
+#define SLAB_TINY_SIZE 16
+#define SLAB_SMALL_SIZE 48
+#define SLAB_BLOCK_SIZE 128
+#define SLAB_LARGE_SIZE 512
+#define SLAB_HDR_SIZE sizeof(MSG_T)
+
+#define SLAB_TINY_COUNT 8
+#define SLAB_SMALL_COUNT 20
+/* %P is the one user of 512 byte blocks. A table of every pid is a header and
+   MAX_PROCS lines of at most TOP_LINE_SIZE bytes, 5 blocks, and the UART
+   i-process holds each until it is sent. One more covers a refresh while the
+   last block of the previous table is still going out, see tools/top_model.c */
+#define SLAB_LARGE_COUNT 6          /* the 128 byte class gets whatever RAM is left, see memory_init */
+#define SLAB_SLOT_META (2 * sizeof(int) + sizeof(U16) + 2 * sizeof(U8)) /* per slot arrays */
+
+#define STACK_HEAP_SIZE 0x800       /* kept free for stacks of created processes */
+
+/* free blocks only i-processes may take, so interrupt side sends never fail
+   because processes drained a class. Proxies are all a send can need: an
+   i-process sending a block that is still queued elsewhere takes one, and
+   processes can hold all SLAB_TINY_COUNT of them. The UART notifies KCD
+   without a block, so no 128 byte block is kept */
+#define IPROC_RESERVE_PROXIES 2
+#define IPROC_RESERVE_BLOCKS 0
+
+#define SLAB_WAIT_QUOTA -1          /* m_wait_slab of a process blocked at its m_mem_quota */
+
+/* references of shared blocks tracked per holder, share_memory_block fails beyond it */
+#define SHARE_REFS_MAX 32
+
+/* one size class, its blocks are slots first .. first + count - 1 */
+typedef struct slab_class {
+	U32 block_size;             /* bytes per block, without the header */
+	U8 *base;                   /* address of the header of its first block */
+	int first;                  /* slot of its first block */
+	int count;                  /* number of blocks in the class */
+	int free_head;              /* first free slot, -1 if the class is empty */
+	int free_count;             /* number of free blocks */
+	int used_max;               /* high-water mark of blocks in use */
+	U32 failures;               /* requests that returned NULL */
+	U32 blocked;                /* requests that blocked the caller */
+	U32 waste;                  /* bytes of the blocks in use beyond what was asked for */
+	U32 waste_max;              /* high-water mark of waste */
+	int irq_reserve;            /* last free blocks kept for i-processes */
+	U32 irq_hits;               /* i-process requests served from that reserve */
+	U32 irq_exhausted;          /* i-process requests that found the class empty */
+} SLAB_CLASS;
+
+/* references one process holds of a shared block, free while count is 0.
+   A block that is not shared has one holder, flag[slot] */
+typedef struct share_holder {
+	U16 slot;
+	U8 pid;
+	U8 count;
+} SHARE_HOLDER;
+
+/* free range of the stack heap */
+typedef struct stack_range {
+	U8 *start;
+	U32 size;
+} STACK_RANGE;
+
 /* ----- Variables ----- */
 /* This symbol is defined in the scatter file (see RVCT Linker User Guide) */  
 extern unsigned int Image$$RW_IRAM1$$ZI$$Limit; 
 extern PCB **gp_pcbs;
-extern PROC_INIT g_proc_table[NUM_TEST_PROCS];
+extern PROC_INIT g_proc_table[NUM_PROCS];
+extern SLAB_CLASS g_slab[SLAB_CLASSES];
+extern int *flag;
+extern int g_slab_slots;
+extern int g_mem_reserve_left;
 
 /* ----- Functions ------ */
 void memory_init(void);
 U32 *alloc_stack(U32 size_b);
+void *k_request_memory(int size);
 void *k_request_memory_block(void);
+int k_mtext_size(void *p_msg);
 int k_release_memory_block(void *);
+MSG_T *k_msg_header(void *p_msg, int pid);
+void *k_msg_received(MSG_T *p_hdr);
+void k_msg_drop(MSG_T *p_hdr);
+int k_share_memory_block(void *p_mem_blk, int n);
+void k_block_owner(void *p_mem_blk, int pid);
+int k_msg_held(void *p_msg, int pid);
+void k_release_owned_blocks(int pid);
+void k_uncharge_blocks(int pid);
+int k_mem_admits(PCB *p_pcb, int c);
+int k_pool_capacity(int size);
+void stack_heap_init(void);
+U32 *stack_alloc(U32 size_b);
+void stack_free(U32 *sp, U32 size_b);
 
 #endif /* ! K_MEM_H_ */
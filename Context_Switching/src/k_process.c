@@ -14,9 +14,14 @@
  */
 
 #include <LPC17xx.h>
+#include <string.h>
 #include <system_LPC17xx.h>
 #include "uart_polling.h"
 #include "k_process.h"
+#include "k_memory.h"
+#include "k_log.h"
+#include "k_trace.h"
+#include "timer.h"
 #include "kernel_procs.h"
 #include "system_proc.h"
 #ifdef DEBUG_0
@@ -40,11 +45,42 @@ extern PROC_INIT g_system_procs[NUM_SYSTEM_PROCS];
  */
  
  //ready queue and blocked queue (each priority has a queue)
-int processQueue[5][NUM_PROCS] = {0}; 
-int blockedQueue[5][NUM_PROCS] = {0};
+ //the ready queue is a FIFO of pcbs per priority, linked through mp_next/mp_prev.
+ //bit (31 - priority) of g_ready_bitmap is set while that priority's queue is non-empty,
+ //so the highest ready priority is a single CLZ
+PCB *g_ready_head[NUM_PRIORITIES] = {NULL};
+PCB *g_ready_tail[NUM_PRIORITIES] = {NULL};
+U32 g_ready_bitmap = 0;
+ //EDF processes ready by earliest absolute deadline, ahead of every priority queue
+PCB *gp_edf_head = NULL;
+U32 g_edf_util = 0;          //admitted EDF load in 1/1000, at most EDF_UTIL_MAX
+ //periodic processes waiting for their next release, earliest first
+PCB *gp_wait_head = NULL;
+int blockedQueue[5][MAX_PROCS] = {0};
+
+#define READY_BIT(prio) (0x80000000u >> (prio))
+#define EDF_UTIL_MAX 1000
+
+extern volatile uint32_t g_timer_count;
 
 int atomic_counter = 0;
 
+//time slices that ran out and were preempted by the timer vs. given up through a kernel call
+U32 g_slices_forced = 0;
+U32 g_slices_voluntary = 0;
+
+#define SVC_EXCEPTION 11 //IPSR while running a kernel call
+
+//wake-ups from kernel calls that led to a switch vs. ones where the running process stayed
+U32 g_preempt_switches = 0;
+U32 g_preempt_avoided = 0;
+
+PCB *gp_free_pcbs = NULL;    //unused pcbs of created processes, linked through mp_next
+PCB *gp_handoff = NULL;      //process to switch to directly instead of popQ, see k_send_and_receive
+
+int g_release_voluntary = 0; //the pending switch was asked for by a kernel call
+int g_svc_restart = 0;       //the current kernel call blocked, see k_restart_call
+
 void atomic_on() {
 	atomic_counter++;
 	//if (atomic_counter == 1) {
@@ -62,7 +98,7 @@ void atomic_off() {
 
 void addBlockedQ(int pid, int priority) {
 	int i=0;
-	for (i = 0; i < NUM_PROCS; i++) {		
+	for (i = 0; i < MAX_PROCS; i++) {		
 		if (blockedQueue[priority][i] == -1) {
 			blockedQueue[priority][i] = pid;
 			break;
@@ -75,16 +111,26 @@ void printQ() {
 	int i = 0;
 	int k = 0;		
 	
+	PCB *it;
+	
 	printf("Process Ready Queue \r\n");
-	for (i = 0; i < 5; i++) {
-		for (k = 0; k < NUM_PROCS; k++) {		
-			if (processQueue[i][k] == -1) {
-				printf("_  ");
-			} else if (processQueue[i][k] / 10 >= 1){
-				printf("%d ", processQueue[i][k]);
+	printf("EDF: ");
+	for (it = gp_edf_head; it != NULL; it = it->mp_next) {
+		printf("%d@%d ", it->m_pid, it->m_deadline);
+	}
+	printf("\r\n");
+	for (i = 0; i < NUM_PRIORITIES; i++) {
+		k = 0;
+		for (it = g_ready_head[i]; it != NULL; it = it->mp_next) {
+			if (it->m_pid / 10 >= 1){
+				printf("%d ", it->m_pid);
 			} else {
-				printf("%d  ", processQueue[i][k]);
+				printf("%d  ", it->m_pid);
 			}
+			k++;
+		}
+		for (; k < MAX_PROCS; k++) {
+			printf("_  ");
 		}
 		printf("\r\n");
 	}
@@ -96,7 +142,7 @@ void printBlockedQ() {
 	
 	printf("Process Blocked Queue \r\n");
 	for (i = 0; i < 5; i++) {
-		for (k = 0; k < NUM_PROCS; k++) {		
+		for (k = 0; k < MAX_PROCS; k++) {		
 			if (blockedQueue[i][k] == -1) {
 				printf("_  ");
 			} else if (blockedQueue[i][k] / 10 >= 1){
@@ -113,7 +159,7 @@ void printBlockedOnReceiveQ() {
 	int k = 0;		
 	
 	printf("Process Blocked On Receive Queue \r\n");
-	for (k = 0; k < NUM_PROCS; k++) {		
+	for (k = 0; k < MAX_PROCS; k++) {		
 		if (gp_pcbs[k]->m_state == BLOCKED_ON_RECEIVE) {
 			printf("pid: %d priority: %d \r\n", gp_pcbs[k]->m_pid, gp_pcbs[k]->m_priority);
 		}
@@ -122,37 +168,26 @@ void printBlockedOnReceiveQ() {
 }
 
 
-int popBlockedQ() {
-	int i = 0;
-	int pid = -1;
-	// priority
-	for (i = 0; i < 5; i++) {		
-		int k;
-		if (blockedQueue[i][0] == -1) {
-			continue;
-		}
-		
-		//find the first blocked on memory
-		for (k = 0; k < NUM_PROCS; k++) {
-			pid = blockedQueue[i][k];
-			if (pid == -1) 
-				break;
-			
-			if (gp_pcbs[pid]->m_state != BLOCKED_ON_ENV) {
-				int l;				
-				//shift rest down
-				for (l = k + 1; l < NUM_PROCS; l++) {
-					blockedQueue[i][l-1] = blockedQueue[i][l];
-				}
-				blockedQueue[i][NUM_PROCS-1] = -1;	
-				return pid;
+//unlink pid from the blocked queue of its priority, 0 if it was not there
+int removeBlockedQ(int pid) {
+	int priority = gp_pcbs[pid]->m_priority;
+	int i;
+	int j;
+	
+	for (i = 0; i < MAX_PROCS; i++) {
+		if (blockedQueue[priority][i] == pid) {
+			for (j = i; j < MAX_PROCS - 1; j++) {
+				blockedQueue[priority][j] = blockedQueue[priority][j+1];
 			}
-		}	
-	}		
-  return -1;	 
+			blockedQueue[priority][MAX_PROCS-1] = -1;
+			return 1;
+		}
+	}
+	return 0;
 }
 
-int popBlockedEnvQ() {
+//first process by priority blocked on a block of size class slab that can have it now
+int popBlockedQ(int slab) {
 	int i = 0;
 	int pid = -1;
 	// priority
@@ -162,19 +197,19 @@ int popBlockedEnvQ() {
 			continue;
 		}
 		
-		//find the first blocked on memory
-		for (k = 0; k < NUM_PROCS; k++) {
+		//find the first blocked on this class
+		for (k = 0; k < MAX_PROCS; k++) {
 			pid = blockedQueue[i][k];
 			if (pid == -1) 
 				break;
 			
-			if (gp_pcbs[pid]->m_state == BLOCKED_ON_ENV) {
+			if (gp_pcbs[pid]->m_wait_slab == slab && k_mem_admits(gp_pcbs[pid], slab)) {
 				int l;				
 				//shift rest down
-				for (l = k + 1; l < NUM_PROCS; l++) {
+				for (l = k + 1; l < MAX_PROCS; l++) {
 					blockedQueue[i][l-1] = blockedQueue[i][l];
 				}
-				blockedQueue[i][NUM_PROCS-1] = -1;	
+				blockedQueue[i][MAX_PROCS-1] = -1;	
 				return pid;
 			}
 		}	
@@ -195,11 +230,11 @@ int popBlockedQueue() {
 		// iterate through and shift
 		pid = blockedQueue[i][0];
 		
-		for (k = 1; k < NUM_PROCS; k++) {
+		for (k = 1; k < MAX_PROCS; k++) {
 			blockedQueue[i][k-1] = blockedQueue[i][k];
 		}
 		
-		blockedQueue[i][NUM_PROCS-1] = -1;	
+		blockedQueue[i][MAX_PROCS-1] = -1;	
 		break;
 	}
 		
@@ -207,58 +242,177 @@ int popBlockedQueue() {
 }*/
 
 
+//push pid to the tail of the ready queue of the given priority
 void addQ(int pid, int priority) {
-	int i = 0;
+	PCB *p_pcb = gp_pcbs[pid];
+	PCB *it;
 	
-	for (i = 0; i < NUM_PROCS; i++) {		
-		if (processQueue[priority][i] == -1) {
-			processQueue[priority][i] = pid;
-			break;
+	if (p_pcb->m_edf) {
+		//after the ones with an earlier or equal deadline, so equal deadlines stay FIFO
+		p_pcb->mp_prev = NULL;
+		for (it = gp_edf_head; it != NULL && (int)(it->m_deadline - p_pcb->m_deadline) <= 0; it = it->mp_next) {
+			p_pcb->mp_prev = it;
 		}
+		p_pcb->mp_next = it;
+		if (it != NULL) {
+			it->mp_prev = p_pcb;
+		}
+		if (p_pcb->mp_prev != NULL) {
+			p_pcb->mp_prev->mp_next = p_pcb;
+		} else {
+			gp_edf_head = p_pcb;
+		}
+		return;
 	}
-			
+	
+	p_pcb->mp_next = NULL;
+	p_pcb->mp_prev = g_ready_tail[priority];
+	if (g_ready_tail[priority] != NULL) {
+		g_ready_tail[priority]->mp_next = p_pcb;
+	} else {
+		g_ready_head[priority] = p_pcb;
+	}
+	g_ready_tail[priority] = p_pcb;
+	
+	g_ready_bitmap |= READY_BIT(priority);
 }
 
-int popQ() {
-	int i = 0;
-	// priority
-	for (i = 0; i < 5; i++) {
-		int pid;
-		int k;
-		if (processQueue[i][0] == -1) {
-			continue;
+//1 if the pcb is linked into the ready queue of its current priority
+int inQ(PCB *p_pcb) {
+	if (p_pcb->m_edf) {
+		return p_pcb->mp_prev != NULL || gp_edf_head == p_pcb;
+	}
+	return p_pcb->mp_prev != NULL || g_ready_head[p_pcb->m_priority] == p_pcb;
+}
+
+//unlink a pcb from anywhere in the ready queue of the given priority
+void removeQ(PCB *p_pcb, int priority) {
+	if (p_pcb->m_edf) {
+		if (p_pcb->mp_prev != NULL) {
+			p_pcb->mp_prev->mp_next = p_pcb->mp_next;
+		} else {
+			gp_edf_head = p_pcb->mp_next;
 		}
-		// iterate through and shift
-		pid = processQueue[i][0];
-		for (k = 1; k < NUM_PROCS; k++) {
-			processQueue[i][k-1] = processQueue[i][k];
+		if (p_pcb->mp_next != NULL) {
+			p_pcb->mp_next->mp_prev = p_pcb->mp_prev;
 		}
-		
-		// Set last pid to -1 
-		processQueue[i][NUM_PROCS-1] = -1;
+		p_pcb->mp_next = NULL;
+		p_pcb->mp_prev = NULL;
+		return;
+	}
+	
+	if (p_pcb->mp_prev != NULL) {
+		p_pcb->mp_prev->mp_next = p_pcb->mp_next;
+	} else {
+		g_ready_head[priority] = p_pcb->mp_next;
+	}
+	
+	if (p_pcb->mp_next != NULL) {
+		p_pcb->mp_next->mp_prev = p_pcb->mp_prev;
+	} else {
+		g_ready_tail[priority] = p_pcb->mp_prev;
+	}
+	
+	p_pcb->mp_next = NULL;
+	p_pcb->mp_prev = NULL;
+	
+	if (g_ready_head[priority] == NULL) {
+		g_ready_bitmap &= ~READY_BIT(priority);
+	}
+}
 
-		return pid;	// highest priority proc
-	}	
-	return -1;
+int popQ() {
+	int priority;
+	PCB *p_pcb;
+	
+	if (gp_edf_head != NULL) {
+		p_pcb = gp_edf_head;
+		removeQ(p_pcb, p_pcb->m_priority);
+		return p_pcb->m_pid;
+	}
+	if (g_ready_bitmap == 0) {
+		return -1;
+	}
+	
+	// highest priority proc is the head of the first non-empty queue
+	priority = __CLZ(g_ready_bitmap);
+	p_pcb = g_ready_head[priority];
+	removeQ(p_pcb, priority);
+	
+	return p_pcb->m_pid;
+}
+
+//1 if a should run before b: EDF by earliest deadline, then by priority
+int outranks(PCB *a, PCB *b) {
+	if (a->m_edf && b->m_edf) {
+		return (int)(a->m_deadline - b->m_deadline) < 0;
+	}
+	if (a->m_edf || b->m_edf) {
+		return a->m_edf;
+	}
+	return a->m_priority < b->m_priority;
 }
 
 //return first element in Q
 int peekQ() {
-	int i = 0;
-	for (i = 0; i < 5; i++) {
-		if (processQueue[i][0] == -1) {
-			continue;
-		}
-		return processQueue[i][0];
-	}	
-	return -1;
+	if (gp_edf_head != NULL) {
+		return gp_edf_head->m_pid;
+	}
+	if (g_ready_bitmap == 0) {
+		return -1;
+	}
+	return g_ready_head[__CLZ(g_ready_bitmap)]->m_pid;
+}
+
+/**
+ * @brief: account a blocked process that was just made ready
+ */
+void k_unblocked(PCB *p_pcb)
+{
+	U32 delta;
+	
+	TRACE(TRACE_UNBLOCK, p_pcb->m_pid, 0);
+	if (p_pcb->m_blocked_in == NEW) {
+		return; //readied again before it was switched out
+	}
+	
+	delta = timer_now_us() - p_pcb->m_since;
+	if (p_pcb->m_blocked_in == WAIT_PERIOD) {
+		//idle until its release, not waiting on anything
+	} else if (p_pcb->m_blocked_in == BLOCKED) {
+		p_pcb->m_stats.mem_us += delta;
+	} else {
+		p_pcb->m_stats.recv_us += delta;
+	}
+	p_pcb->m_blocked_in = NEW;
+}
+
+/**
+ * @brief: copy the accounting of pid to p_stats
+ */
+int k_get_process_stats(int pid, PROC_STATS *p_stats) {
+	if (pid < 0 || pid >= MAX_PROCS || p_stats == NULL) {
+		return RTX_ERR;
+	}
+	
+	atomic_on();
+	*p_stats = gp_pcbs[pid]->m_stats;
+	p_stats->state = gp_pcbs[pid]->m_state;
+	p_stats->priority = gp_pcbs[pid]->m_priority;
+	if (gp_pcbs[pid] == gp_current_process) {
+		//include the current time slice
+		p_stats->run_us += timer_now_us() - gp_current_process->m_since;
+	}
+	atomic_off();
+	
+	return RTX_OK;
 }
 
 /** returns the process priority
 **/
 int k_get_process_priority(int pid) {
 	//return -1 if pid is invalid
-	if (pid < 0 || pid > NUM_PROCS) {
+	if (pid < 0 || pid >= MAX_PROCS || gp_pcbs[pid]->m_state == EXITED) {
 		return -1;
 	}
 	
@@ -268,13 +422,11 @@ int k_get_process_priority(int pid) {
 /** set process priority
 **/
 int k_set_process_priority(int pid, int priority) {
-	int i;
-	int j;
 	int oldPriority;
 	
 	//printQ();
 	
-	if (pid < 1 || pid > NUM_PROCS || priority < 0 || priority > 3) {
+	if (pid < 1 || pid >= MAX_PROCS || priority < 0 || priority > 3 || gp_pcbs[pid]->m_state == EXITED) {
 		return -1;
 	}
 	
@@ -285,57 +437,79 @@ int k_set_process_priority(int pid, int priority) {
 		return 0;
 	}
 
-	for (i=0; i<NUM_PROCS; i++) {
-		if (processQueue[oldPriority][i] == pid) {
-			for (j=i; j<NUM_PROCS-1; j++) {
-				processQueue[oldPriority][j] = processQueue[oldPriority][j+1];
-			}				
-			processQueue[oldPriority][NUM_PROCS-1] = -1;
-
-			addQ(pid, priority);
-			break;
-		}
+	if (inQ(gp_pcbs[pid])) {
+		removeQ(gp_pcbs[pid], oldPriority);
+		addQ(pid, priority);
 	}
 	
-	for (i=0; i<NUM_PROCS; i++) {
-		if (blockedQueue[oldPriority][i] == pid) {
-			for (j=i; j<NUM_PROCS-1; j++) {
-				blockedQueue[oldPriority][j] = blockedQueue[oldPriority][j+1];
-			}
-			blockedQueue[oldPriority][NUM_PROCS-1] = -1;
-			addBlockedQ(pid, priority);
-			break;
-		}
+	if (removeBlockedQ(pid)) {
+		addBlockedQ(pid, priority);
 	}
 	
 	(gp_pcbs[pid])->m_priority = priority;
 
-	k_release_processor();
+	k_check_preemption();
 	
 	return 0;
 }
 
+/**
+ * @brief: bytes alloc_stack will hand out for the static processes, so
+ *         memory_init can size the pools before process_init runs
+ */
+U32 proc_stack_total(void)
+{
+	U32 total = NULL_PROC_STACK;
+	int i;
+
+	set_test_procs();
+	set_system_procs();
+	set_kernel_procs();
+	/* alloc_stack keeps every stack 8 bytes aligned */
+	for (i = 0; i < NUM_TEST_PROCS; i++) {
+		total += (g_test_procs[i].m_stack_size + 7) & ~7;
+	}
+	for (i = 0; i < NUM_SYSTEM_PROCS; i++) {
+		total += (g_system_procs[i].m_stack_size + 7) & ~7;
+	}
+	for (i = 0; i < NUM_KERNEL_PROCS; i++) {
+		total += (g_kernel_procs[i].m_stack_size + 7) & ~7;
+	}
+	return total;
+}
 
-void process_init() 
+void process_init()
 {
 	int i;
 	int j;
-	U32 *sp;
   
 	for (i = 0; i < 5; i++) {
-		for (j = 0; j < NUM_PROCS; j++) {
-			processQueue[i][j] = -1;
+		for (j = 0; j < MAX_PROCS; j++) {
 			blockedQueue[i][j] = -1;
 		}
 	}
 	
+	for (i = 0; i < NUM_PRIORITIES; i++) {
+		g_ready_head[i] = NULL;
+		g_ready_tail[i] = NULL;
+	}
+	g_ready_bitmap = 0;
+	
+	for (i = 0; i < MAX_PROCS; i++) {
+		(gp_pcbs[i])->mp_next = NULL;
+		(gp_pcbs[i])->mp_prev = NULL;
+	}
+	
   /* fill out the initialization table */
 	
 	//null process
 	g_proc_table[0].m_pid = PID_NULL;
-	g_proc_table[0].m_stack_size = 0x100;
+	g_proc_table[0].m_stack_size = NULL_PROC_STACK;
 	g_proc_table[0].mpf_start_pc = &null_process;
 	g_proc_table[0].m_priority = 4;
+	g_proc_table[0].m_quantum = 0;
+	g_proc_table[0].m_mem_quota = 0;
+	g_proc_table[0].m_mem_reserve = 0;
 	addQ(PID_NULL, 4);
 	
 	//test process
@@ -345,6 +519,9 @@ void process_init()
 		g_proc_table[i + NUM_NULL_PROCS].m_stack_size = g_test_procs[i].m_stack_size;
 		g_proc_table[i + NUM_NULL_PROCS].mpf_start_pc = g_test_procs[i].mpf_start_pc;
 		g_proc_table[i + NUM_NULL_PROCS].m_priority = g_test_procs[i].m_priority;
+		g_proc_table[i + NUM_NULL_PROCS].m_quantum = g_test_procs[i].m_quantum;
+		g_proc_table[i + NUM_NULL_PROCS].m_mem_quota = g_test_procs[i].m_mem_quota;
+		g_proc_table[i + NUM_NULL_PROCS].m_mem_reserve = g_test_procs[i].m_mem_reserve;
 		
 		addQ(g_proc_table[i + NUM_NULL_PROCS].m_pid, g_proc_table[i + NUM_NULL_PROCS].m_priority);
 	}
@@ -355,6 +532,9 @@ void process_init()
 		g_proc_table[i + NUM_NULL_PROCS + NUM_TEST_PROCS].m_stack_size = g_system_procs[i].m_stack_size;
 		g_proc_table[i + NUM_NULL_PROCS + NUM_TEST_PROCS].mpf_start_pc = g_system_procs[i].mpf_start_pc;
 		g_proc_table[i + NUM_NULL_PROCS + NUM_TEST_PROCS].m_priority = g_system_procs[i].m_priority;						
+		g_proc_table[i + NUM_NULL_PROCS + NUM_TEST_PROCS].m_quantum = g_system_procs[i].m_quantum;
+		g_proc_table[i + NUM_NULL_PROCS + NUM_TEST_PROCS].m_mem_quota = g_system_procs[i].m_mem_quota;
+		g_proc_table[i + NUM_NULL_PROCS + NUM_TEST_PROCS].m_mem_reserve = g_system_procs[i].m_mem_reserve;
 	}
 	addQ(PID_CRT, 0);
 	addQ(PID_KCD, 0);
@@ -371,6 +551,9 @@ void process_init()
 		g_proc_table[i + NUM_NULL_PROCS + NUM_TEST_PROCS + NUM_SYSTEM_PROCS].m_stack_size = g_kernel_procs[i].m_stack_size;
 		g_proc_table[i + NUM_NULL_PROCS + NUM_TEST_PROCS + NUM_SYSTEM_PROCS].mpf_start_pc = g_kernel_procs[i].mpf_start_pc;
 		g_proc_table[i + NUM_NULL_PROCS + NUM_TEST_PROCS + NUM_SYSTEM_PROCS].m_priority = g_kernel_procs[i].m_priority;			
+		g_proc_table[i + NUM_NULL_PROCS + NUM_TEST_PROCS + NUM_SYSTEM_PROCS].m_quantum = g_kernel_procs[i].m_quantum;
+		g_proc_table[i + NUM_NULL_PROCS + NUM_TEST_PROCS + NUM_SYSTEM_PROCS].m_mem_quota = g_kernel_procs[i].m_mem_quota;
+		g_proc_table[i + NUM_NULL_PROCS + NUM_TEST_PROCS + NUM_SYSTEM_PROCS].m_mem_reserve = g_kernel_procs[i].m_mem_reserve;
 	}
   
 	//for (i = 0; i <  NUM_KERNEL_PROCS + NUM_TEST_PROCS; i++) {
@@ -379,22 +562,283 @@ void process_init()
 	//}
 	
 	/* initilize exception stack frame (i.e. initial context) for each process */
-	for ( i = 0; i < 16; i++ ) {
-		int j;
-		(gp_pcbs[i])->m_pid = (g_proc_table[i]).m_pid;
-		(gp_pcbs[i])->m_priority = (g_proc_table[i]).m_priority;		
-		(gp_pcbs[i])->m_state = NEW;
+	for ( i = 0; i < NUM_PROCS; i++ ) {
+		pcb_init(gp_pcbs[i], &g_proc_table[i], alloc_stack((g_proc_table[i]).m_stack_size));
+	}
+	
+	/* pcbs of created processes, the RAM left over after the static stacks is for their stacks */
+	gp_free_pcbs = NULL;
+	for ( i = MAX_PROCS - 1; i >= NUM_PROCS; i-- ) {
+		(gp_pcbs[i])->m_pid = i;
+		(gp_pcbs[i])->m_state = EXITED;
 		(gp_pcbs[i])->head = NULL;
 		(gp_pcbs[i])->tail = NULL;
+		(gp_pcbs[i])->m_stack_size = 0;
+		(gp_pcbs[i])->mp_next = gp_free_pcbs;
+		gp_free_pcbs = gp_pcbs[i];
+	}
+	stack_heap_init();
+}
+
+/**
+ * @brief: reset p_pcb and build the initial context of p_init on the stack below sp
+ */
+void pcb_init(PCB *p_pcb, PROC_INIT *p_init, U32 *sp)
+{
+	int j;
+	
+	p_pcb->m_pid = p_init->m_pid;
+	p_pcb->m_priority = p_init->m_priority;		
+	p_pcb->m_quantum = p_init->m_quantum;
+	p_pcb->m_slice_left = p_init->m_quantum;
+	p_pcb->m_reply_from = -1;
+	p_pcb->m_notify = 0;
+	p_pcb->m_mem_quota = p_init->m_mem_quota;
+	p_pcb->m_mem_reserve = p_init->m_mem_reserve;
+	p_pcb->m_mem_block = 0;
+	g_mem_reserve_left += p_init->m_mem_reserve;
+	memset(&p_pcb->m_stats, 0, sizeof(PROC_STATS));
+	p_pcb->m_since = 0;
+	p_pcb->m_blocked_in = NEW;
+	p_pcb->m_state = NEW;
+	p_pcb->head = NULL;
+	p_pcb->tail = NULL;
+	p_pcb->mp_next = NULL;
+	p_pcb->mp_prev = NULL;
+	p_pcb->mp_stack_top = sp;
+	p_pcb->m_stack_size = 0;
+	p_pcb->m_edf = 0;
+	p_pcb->m_period = 0;
+	p_pcb->m_util = 0;
+	p_pcb->mp_wait_next = NULL;
+	
+	*(--sp)  = INITIAL_xPSR;      // user process initial xPSR  
+	*(--sp)  = (U32)(p_init->mpf_start_pc); // PC contains the entry point of the process
+	*(--sp)  = 0x0;               // LR, static processes never return
+	for ( j = 0; j < 5; j++ ) { // R0-R3, R12 are cleared with 0
+		*(--sp) = 0x0;
+	}
+	for ( j = 0; j < 8; j++ ) { // R4-R11 popped by PendSV_Handler
+		*(--sp) = 0x0;
+	}
+	p_pcb->mp_sp = sp;
+}
+
+/**
+ * @brief: start a new process at entry
+ * @return: its pid, RTX_ERR if there is no free pcb or not enough RAM for the stack
+ */
+int k_create_process(void (*entry)(), int priority, int stack_size)
+{
+	PCB *p_pcb;
+	PROC_INIT init;
+	U32 *sp;
+	U32 size;
+	
+	if (entry == NULL || priority < 0 || priority > 3 || stack_size < 0) {
+		return RTX_ERR;
+	}
+	size = stack_size < MIN_STACK_SIZE ? MIN_STACK_SIZE : (stack_size + 7) & ~7;
+	
+	atomic_on();
+	
+	p_pcb = gp_free_pcbs;
+	if (p_pcb == NULL) {
+		atomic_off();
+		return RTX_ERR;
+	}
+	sp = stack_alloc(size);
+	if (sp == NULL) {
+		atomic_off();
+		return RTX_ERR;
+	}
+	gp_free_pcbs = p_pcb->mp_next;
+	
+	init.m_pid = p_pcb->m_pid;
+	init.m_priority = priority;
+	init.m_stack_size = size;
+	init.mpf_start_pc = entry;
+	init.m_quantum = RR_QUANTUM;
+	init.m_mem_quota = 0;
+	init.m_mem_reserve = 0;
+	pcb_init(p_pcb, &init, sp);
+	p_pcb->m_stack_size = size;
+	k_saved_frame(p_pcb)[5] = (U32)&process_return; // LR, returning from entry exits
+	
+	addQ(p_pcb->m_pid, priority);
+	k_check_preemption();
+	
+	atomic_off();
+	return p_pcb->m_pid;
+}
+
+/**
+ * @brief: end the calling process, which must have been made by create_process.
+ * Its mailbox, the memory blocks it holds, its stack and its pcb are reclaimed.
+ * @return: only returns, with RTX_ERR, for a static process
+ */
+int k_exit_process(void)
+{
+	PCB *p_pcb = gp_current_process;
+	MSG_T *p_hdr;
+	int pid;
+	
+	if (p_pcb->m_stack_size == 0) {
+		return RTX_ERR;
+	}
+	
+	atomic_on();
+	
+	//messages nobody will receive, delayed ones included, before the blocks
+	//it holds are released (those in the timing wheel are among them)
+	while ((p_hdr = p_pcb->head) != NULL) {
+		p_pcb->head = p_hdr->next;
+		k_msg_drop(p_hdr);
+	}
+	p_pcb->tail = NULL;
+	timer_purge(p_pcb->m_pid);
+	k_release_owned_blocks(p_pcb->m_pid);
+	
+	//the reply to send_and_receive will not come, it returns NULL
+	for (pid = 0; pid < MAX_PROCS; pid++) {
+		PCB *p_caller = gp_pcbs[pid];
 		
-		sp = alloc_stack((g_proc_table[i]).m_stack_size);
-		*(--sp)  = INITIAL_xPSR;      // user process initial xPSR  
-		*(--sp)  = (U32)((g_proc_table[i]).mpf_start_pc); // PC contains the entry point of the process
-		for ( j = 0; j < 6; j++ ) { // R0-R3, R12 are cleared with 0
-			*(--sp) = 0x0;
+		if (p_caller->m_state == BLOCKED_ON_REPLY && p_caller->m_reply_from == p_pcb->m_pid) {
+			k_saved_frame(p_caller)[0] = (U32)NULL;
+			p_caller->m_state = RDY;
+			k_unblocked(p_caller);
+			addQ(pid, p_caller->m_priority);
 		}
-		(gp_pcbs[i])->mp_sp = sp;
 	}
+	
+	//KCD drops its commands before the pid is handed out again
+	g_kcd_exited |= 1 << p_pcb->m_pid;
+	
+	k_uncharge_blocks(p_pcb->m_pid);
+	g_edf_util -= p_pcb->m_util;
+	p_pcb->m_util = 0;
+	p_pcb->m_edf = 0;
+	
+	//we are on the kernel stack, the freed one is not touched again
+	//until PendSV has switched away from it
+	p_pcb->m_state = EXITED;
+	stack_free(p_pcb->mp_stack_top, p_pcb->m_stack_size);
+	p_pcb->m_stack_size = 0;
+	p_pcb->mp_next = gp_free_pcbs;
+	gp_free_pcbs = p_pcb;
+	
+	k_release_processor();
+	
+	atomic_off();
+	return RTX_OK;
+}
+
+/**
+ * @brief: make the calling process periodic, its first release is now.
+ * With edf set it is scheduled by earliest absolute deadline above every priority,
+ * admitted only while the total wcet/deadline of the EDF processes stays within 1.
+ * A period of 0 makes it an ordinary fixed priority process again.
+ * @return: RTX_ERR on bad parameters or if admission fails
+ */
+int k_set_period(int period, int deadline, int wcet, int edf)
+{
+	PCB *p_pcb = gp_current_process;
+	U32 util = 0;
+	
+	if (period < 0 || (period > 0 && (deadline <= 0 || deadline > period || wcet < 0 || wcet > deadline))) {
+		return RTX_ERR;
+	}
+	if (period > 0 && edf) {
+		//density rounded up, a sufficient test for deadlines shorter than the period
+		util = (wcet * EDF_UTIL_MAX + deadline - 1) / deadline;
+	}
+	
+	atomic_on();
+	if (g_edf_util - p_pcb->m_util + util > EDF_UTIL_MAX) {
+		atomic_off();
+		return RTX_ERR;
+	}
+	g_edf_util += util - p_pcb->m_util;
+	p_pcb->m_util = util;
+	
+	//running, so in no queue while the class changes
+	p_pcb->m_edf = period > 0 && edf;
+	p_pcb->m_period = period;
+	p_pcb->m_rel_deadline = deadline;
+	p_pcb->m_release = g_timer_count;
+	p_pcb->m_deadline = g_timer_count + deadline;
+	k_check_preemption();
+	
+	atomic_off();
+	return RTX_OK;
+}
+
+/**
+ * @brief: end the current period of the calling process and block until its next release.
+ * Finishing after the deadline counts a miss and the lateness in its stats.
+ * A process that overran into its next period keeps running with the new deadline.
+ */
+int k_wait_next_period(void)
+{
+	PCB *p_pcb = gp_current_process;
+	PCB **pp;
+	int late;
+	
+	if (p_pcb->m_period == 0) {
+		return RTX_ERR;
+	}
+	
+	atomic_on();
+	late = (int)(g_timer_count - p_pcb->m_deadline);
+	if (late > 0) {
+		p_pcb->m_stats.misses++;
+		if (late > (int)p_pcb->m_stats.lateness_max) {
+			p_pcb->m_stats.lateness_max = late;
+		}
+	}
+	
+	p_pcb->m_release += p_pcb->m_period;
+	p_pcb->m_deadline = p_pcb->m_release + p_pcb->m_rel_deadline;
+	if ((int)(p_pcb->m_release - g_timer_count) <= 0) {
+		k_check_preemption();
+		atomic_off();
+		return RTX_OK;
+	}
+	
+	for (pp = &gp_wait_head; *pp != NULL && (int)((*pp)->m_release - p_pcb->m_release) <= 0; pp = &(*pp)->mp_wait_next) {
+	}
+	p_pcb->mp_wait_next = *pp;
+	*pp = p_pcb;
+	p_pcb->m_state = WAIT_PERIOD;
+	k_release_processor();
+	
+	atomic_off();
+	return RTX_OK;
+}
+
+/**
+ * @brief: ready the periodic processes whose release time has come
+ * PRE: called from the timer IRQ once g_timer_count is up to date
+ */
+void k_period_tick(void)
+{
+	PCB *p_pcb;
+	
+	while ((p_pcb = gp_wait_head) != NULL && (int)(g_timer_count - p_pcb->m_release) >= 0) {
+		gp_wait_head = p_pcb->mp_wait_next;
+		p_pcb->mp_wait_next = NULL;
+		p_pcb->m_state = RDY;
+		k_unblocked(p_pcb);
+		addQ(p_pcb->m_pid, p_pcb->m_priority);
+	}
+}
+
+/**
+ * @return: g_timer_count of the earliest periodic release, -1 if none is waiting
+ */
+int k_next_release(void)
+{
+	return gp_wait_head == NULL ? -1 : (int)gp_wait_head->m_release;
 }
 
 /*@brief: scheduler, pick the pid of the next to run process
@@ -419,8 +863,8 @@ PCB *scheduler(void)
  *@return: RTX_OK upon success
  *         RTX_ERR upon failure
  *PRE:  p_pcb_old and gp_current_process are pointing to valid PCBs.
- *POST: if gp_current_process was NULL, then it gets set to pcbs[0].
- *      No other effect on other global variables.
+ *      Both stack pointers are already saved/loaded by k_context_switch.
+ *POST: only the states of the two pcbs are updated.
  */
 int process_switch(PCB *p_pcb_old) 
 {
@@ -428,97 +872,191 @@ int process_switch(PCB *p_pcb_old)
 	
 	state = gp_current_process->m_state;
 	
-	if (state == NEW) {
-		if (gp_current_process != p_pcb_old && p_pcb_old->m_state != NEW) {
-			//lol
-		  if(BLOCKED_ON_RECEIVE != p_pcb_old->m_state)
-				p_pcb_old->m_state = RDY;
-			
-			p_pcb_old->mp_sp = (U32 *) __get_MSP();
-		}
-		gp_current_process->m_state = RUN;
-		__set_MSP((U32) gp_current_process->mp_sp);
-		__rte();  // pop exception stack frame from the stack for a new processes
-	} 
-	
-	/* The following will only execute if the if block above is FALSE */
-
 	if (gp_current_process != p_pcb_old) {
-		if (state == RDY){ 
-			//frank's non-legit hack
-			if(BLOCKED_ON_RECEIVE != p_pcb_old->m_state)
+		if (state == NEW || state == RDY) {
+			// a blocked process keeps its state until it is woken up
+			if (RUN == p_pcb_old->m_state) {
 				p_pcb_old->m_state = RDY;
-			
-			p_pcb_old->mp_sp = (U32 *) __get_MSP(); // save the old process's sp
-			gp_current_process->m_state = RUN;
-			__set_MSP((U32) gp_current_process->mp_sp); //switch to the new proc's stack    
-		} else {			
+			}
+		} else {
 			gp_current_process = p_pcb_old; // revert back to the old proc on error
 			return RTX_ERR;
-		} 
+		}
 	}
+	gp_current_process->m_state = RUN;
+	gp_current_process->m_slice_left = gp_current_process->m_quantum;
 	return RTX_OK;
 }
+
 /**
  * @brief release_processor(). 
  * @return RTX_ERR on error and zero on success
- * POST: gp_current_process gets updated to next to run process
+ * POST: a context switch is pending, it is done by PendSV as soon as
+ *       the kernel call or interrupt handler returns
+ */
+int k_release_processor(void)
+{		
+	if (__get_IPSR() == SVC_EXCEPTION) {
+		g_release_voluntary = 1;
+	}
+	k_pend_switch();
+	return RTX_OK;
+}
+
+/**
+ * @brief: request a context switch from an interrupt handler.
+ * The switch is done by PendSV once no other handler is active,
+ * so the calling ISR finishes in bounded time.
+ */
+void k_pend_switch(void)
+{
+	SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+}
+
+/**
+ * @brief: preempt the current process only if a ready process outranks it.
+ * Used by every path that readies a process. From an i-process nothing is
+ * done here, the interrupt handler checks once the i-process has finished.
+ * @return: 1 if a context switch is pending, 0 otherwise
+ */
+int k_check_preemption(void)
+{
+	int pid;
+	
+	if (gp_current_process != NULL && IS_IPROC(gp_current_process->m_pid)) {
+		return 0;
+	}
+	
+	pid = peekQ();
+	if (pid != -1 && (gp_current_process == NULL || outranks(gp_pcbs[pid], gp_current_process))) {
+		LOG2(LOG_PREEMPT, gp_current_process == NULL ? PID_NULL : gp_current_process->m_pid, pid);
+		if (__get_IPSR() == SVC_EXCEPTION) {
+			g_preempt_switches++;
+		}
+		k_pend_switch();
+		return 1;
+	}
+	
+	if (__get_IPSR() == SVC_EXCEPTION) {
+		g_preempt_avoided++;
+	}
+	return 0;
+}
+
+/**
+ * @brief: make the current kernel call start over once the process runs again.
+ * A kernel call that has to block marks the process blocked, calls this and
+ * k_release_processor() and returns. SVC_Handler then rewinds the saved PC
+ * to the SVC instruction instead of storing a return value.
  */
+void k_restart_call(void)
+{
+	g_svc_restart = 1;
+}
 
 /*
 	the normal flow is to add the running process to the ready priorityQueue, and then
 	take the first element in the priorityQueue
 */
-int k_release_processor(void)
-{		
+/**
+ * @brief: c part of PendSV_Handler in HAL.c
+ * @param: p_sp, PSP of the current process with R4-R11 already pushed
+ * @return: PSP of the process to run, R4-R11 still to be popped
+ */
+U32 *k_context_switch(U32 *p_sp)
+{
 	PCB *p_pcb_old = gp_current_process;
 	
-	//printQ();
+	// PendSV has the lowest priority, TIMER0 and UART0 would otherwise change
+	// the ready queue and gp_current_process halfway through the switch
+	atomic_on();
 	
 	// UNLESS system just started(gp_current_process is NULL) or current process is blocked
-	// add current process to ready queue
-	if (gp_current_process != NULL  && gp_current_process->m_state != BLOCKED && gp_current_process->m_state != BLOCKED_ON_ENV
-			&& gp_current_process->m_state != BLOCKED_ON_RECEIVE) {
-		addQ(gp_current_process->m_pid, gp_current_process->m_priority);		
+	// add current process to ready queue. A process an interrupt woke up after it
+	// blocked is RDY and already queued, adding it again would link it to itself
+	if (p_pcb_old != NULL) {
+		p_pcb_old->mp_sp = p_sp;
+		if ((p_pcb_old->m_state == RUN || p_pcb_old->m_state == RDY) && !inQ(p_pcb_old)) {
+			addQ(p_pcb_old->m_pid, p_pcb_old->m_priority);		
+		}
 	}
 	
-	//printQ();
+	//direct handoff, unless an interrupt readied something more urgent meanwhile
+	if (gp_handoff != NULL) {
+		int pid = peekQ();
+		if (pid != -1 && outranks(gp_pcbs[pid], gp_handoff)) {
+			addQ(gp_handoff->m_pid, gp_handoff->m_priority);
+			gp_handoff = NULL;
+		}
+	}
 	
 	//take first element from ready queue
-	gp_current_process = scheduler();
-
-	//printQ();
-	
-	if (gp_current_process->m_pid == 11) {
-		int frank;
-		frank = -1;
+	if (gp_handoff != NULL) {
+		gp_current_process = gp_handoff;
+		gp_handoff = NULL;
+	} else {
+		gp_current_process = scheduler();
 	}
 	
-	if (gp_current_process == NULL  ) {		
-		return RTX_ERR;
+	if (gp_current_process == NULL) {
+		gp_current_process = p_pcb_old;
+		g_release_voluntary = 0;
+		atomic_off();
+		return p_sp;
 	}
 	
 	if ( p_pcb_old == NULL ) {
 		p_pcb_old = gp_current_process;
+	} else if (p_pcb_old != gp_current_process && g_release_voluntary) {
+		g_slices_voluntary++;
+	}
+	if (p_pcb_old != gp_current_process) {
+		U32 now = timer_now_us();
+		
+		LOG2(LOG_SWITCH, p_pcb_old->m_pid, gp_current_process->m_pid);
+		p_pcb_old->m_stats.run_us += now - p_pcb_old->m_since;
+		if (p_pcb_old->m_state == EXITED) {
+			//gone, nothing to account
+		} else if (p_pcb_old->m_state != RUN && p_pcb_old->m_state != RDY) {
+			TRACE(TRACE_BLOCK, p_pcb_old->m_pid, p_pcb_old->m_state);
+			p_pcb_old->m_stats.switches_vol++;
+			p_pcb_old->m_blocked_in = p_pcb_old->m_state;
+		} else if (g_release_voluntary) {
+			p_pcb_old->m_stats.switches_vol++;
+		} else {
+			p_pcb_old->m_stats.switches_invol++;
+		}
+		p_pcb_old->m_since = now;
+		gp_current_process->m_since = now;
+		TRACE(TRACE_SWITCH, gp_current_process->m_pid, p_pcb_old->m_pid);
 	}
+	g_release_voluntary = 0;
 
 	//switch to the new process from the old process
 	process_switch(p_pcb_old);
 	
-	return RTX_OK;
+	atomic_off();
+	return gp_current_process->mp_sp;
 }
 
 /* Send p_msg to the process defined at pid */
 int k_send_message(int pid, void *p_msg) {	
 	MSG_T* msg;
 	
-	msg = (MSG_T*)k_request_memory_env();
+	if (pid < 0 || pid >= MAX_PROCS || gp_pcbs[pid]->m_state == EXITED) {
+		return RTX_ERR;
+	}
+	msg = k_msg_header(p_msg, pid);
+	if (msg == NULL) {
+		return RTX_ERR;
+	}
 	atomic_on();
 
 	msg->sender_pid = gp_current_process->m_pid;
-	msg->dest_pid = pid;	
-	msg->msg = p_msg;			
 	msg->delay = -1;
+	k_block_owner(p_msg, pid);
+	TRACE(TRACE_SEND, msg->sender_pid, pid);
+	gp_pcbs[msg->sender_pid]->m_stats.sent++;
 	
 	//push to the tail of the queue
 	msg->next = NULL;				
@@ -532,22 +1070,28 @@ int k_send_message(int pid, void *p_msg) {
 	
 	if ( BLOCKED_ON_RECEIVE == gp_pcbs[pid]->m_state) {
 		gp_pcbs[pid]->m_state = RDY;
+		k_unblocked(gp_pcbs[pid]);
 		addQ(pid, gp_pcbs[pid]->m_priority);			
-		if(gp_current_process->m_pid != PID_UART_IPROC) {
-			atomic_off();
-			k_release_processor();
-			atomic_on();
-		}
+		k_check_preemption();
 	}
 	
 	atomic_off();
+	return RTX_OK;
 }
 
 void send_message_t(MSG_T* msg) {
 	int pid = msg->dest_pid;
 	PCB * dest = gp_pcbs[pid];
 	
+	if (dest->m_state == EXITED) {
+		//the receiver exited while the message was delayed
+		k_msg_drop(msg);
+		return;
+	}
+	
 	atomic_on();
+	TRACE(TRACE_SEND, msg->sender_pid, pid);
+	gp_pcbs[msg->sender_pid]->m_stats.sent++;
 	
  //push to the tail of the queue
 	msg->next = NULL;				
@@ -561,6 +1105,7 @@ void send_message_t(MSG_T* msg) {
 	
 	if (BLOCKED_ON_RECEIVE == gp_pcbs[pid]->m_state) {
 		gp_pcbs[pid]->m_state = RDY;
+		k_unblocked(gp_pcbs[pid]);
 		addQ(pid, gp_pcbs[pid]->m_priority);	
 	}
 	
@@ -571,13 +1116,18 @@ void send_message_t(MSG_T* msg) {
 int k_delayed_send(int pid, void *p_msg, int delay) {	
 	MSG_T* msg;
 		
-	msg = (MSG_T*)k_request_memory_env();
+	if (pid < 0 || pid >= MAX_PROCS || gp_pcbs[pid]->m_state == EXITED) {
+		return RTX_ERR;
+	}
+	msg = k_msg_header(p_msg, pid);
+	if (msg == NULL) {
+		return RTX_ERR;
+	}
 	atomic_on();
 
 	msg->sender_pid = gp_current_process->m_pid;
-	msg->dest_pid = pid;	
-	msg->msg = p_msg;
 	msg->delay = delay;
+	k_block_owner(p_msg, pid);
 	
 	//push to the tail of the queue
 	msg->next = NULL;		
@@ -590,6 +1140,102 @@ int k_delayed_send(int pid, void *p_msg, int delay) {
 	gp_pcbs[PID_TIMER_IPROC]->tail = msg;		
 	
 	atomic_off();
+	return RTX_OK;
+}
+
+/* exception stack frame (R0-R3, R12, LR, PC, xPSR) of a switched out process */
+U32 *k_saved_frame(PCB *p_pcb) {
+	return p_pcb->mp_sp + 8; // above R4-R11 pushed by PendSV_Handler
+}
+
+/**
+ * @brief: send p_msg to pid and block until pid replies.
+ * If pid is blocked in receive_message, the message is handed over in its
+ * saved registers and the kernel switches to it directly, no envelope and
+ * no ready queue pass. Otherwise the message is queued like send_message.
+ * @return: the reply message, NULL on error
+ */
+void *k_send_and_receive(int pid, void *p_msg) {
+	PCB *p_callee;
+	
+	if (pid < 0 || pid >= MAX_PROCS || pid == gp_current_process->m_pid || gp_pcbs[pid]->m_state == EXITED) {
+		return NULL;
+	}
+	if (!k_msg_held(p_msg, gp_current_process->m_pid)) {
+		return NULL; //not a block, or not ours to send
+	}
+	p_callee = gp_pcbs[pid];
+	
+	atomic_on();
+	
+	if (BLOCKED_ON_RECEIVE == p_callee->m_state) {
+		U32 *frame = k_saved_frame(p_callee);
+		
+		//complete the callee's receive_message instead of restarting it
+		*((int *)frame[0]) = gp_current_process->m_pid;
+		frame[0] = (U32)p_msg;
+		frame[6] += 2;
+		
+		p_callee->m_state = RDY;
+		k_block_owner(p_msg, pid);
+		TRACE(TRACE_SEND, gp_current_process->m_pid, pid);
+		gp_current_process->m_stats.sent++;
+		p_callee->m_stats.received++;
+		k_unblocked(gp_pcbs[pid]);
+		gp_handoff = p_callee;
+	} else {
+		atomic_off();
+		if (k_send_message(pid, p_msg) != RTX_OK) {
+			return NULL; //not a block, or blocked on a proxy header and restarted
+		}
+		atomic_on();
+	}
+	
+	gp_current_process->m_reply_from = pid;
+	gp_current_process->m_state = BLOCKED_ON_REPLY;
+	k_release_processor();
+	
+	atomic_off();
+	return NULL; //k_reply stores the real return value
+}
+
+/**
+ * @brief: answer a process blocked in send_and_receive on us.
+ * The reply goes straight into the caller's saved R0, and the caller is
+ * switched to directly unless it is less urgent than we are.
+ */
+int k_reply(int pid, void *p_msg) {
+	PCB *p_caller;
+	
+	if (pid < 0 || pid >= MAX_PROCS || !k_msg_held(p_msg, gp_current_process->m_pid)) {
+		return RTX_ERR;
+	}
+	p_caller = gp_pcbs[pid];
+	
+	atomic_on();
+	
+	if (BLOCKED_ON_REPLY != p_caller->m_state || p_caller->m_reply_from != gp_current_process->m_pid) {
+		atomic_off();
+		return RTX_ERR;
+	}
+	
+	k_saved_frame(p_caller)[0] = (U32)p_msg;
+	p_caller->m_state = RDY;
+	k_block_owner(p_msg, pid);
+	TRACE(TRACE_SEND, gp_current_process->m_pid, pid);
+	gp_current_process->m_stats.sent++;
+	p_caller->m_stats.received++;
+	k_unblocked(gp_pcbs[pid]);
+	
+	if (!outranks(gp_current_process, p_caller)) {
+		gp_handoff = p_caller;
+		k_release_processor();
+	} else {
+		addQ(pid, p_caller->m_priority);
+	}
+	
+	atomic_off();
+	return RTX_OK;
 }
 
 /* This is a blocking receive */
@@ -600,11 +1246,18 @@ void *k_receive_message(int *p_pid) {
 	
 	atomic_on();
 	
-	while (NULL == gp_pcbs[current_pid]->head ||	NULL == gp_pcbs[current_pid]->tail) {
+	if (NULL == gp_pcbs[current_pid]->head ||	NULL == gp_pcbs[current_pid]->tail) {
+		if (gp_current_process->m_notify) {
+			//woken by k_notify, no message attached
+			gp_current_process->m_notify = 0;
+			atomic_off();
+			return NULL;
+		}
 		gp_current_process->m_state = BLOCKED_ON_RECEIVE;		
 		atomic_off();
+		k_restart_call();
 		k_release_processor();		
-		atomic_on();
+		return NULL;
 	}
 	msg_t = gp_pcbs[current_pid]->head;
 	gp_pcbs[current_pid]->head = gp_pcbs[current_pid]->head->next;
@@ -612,14 +1265,31 @@ void *k_receive_message(int *p_pid) {
 		gp_pcbs[current_pid]->tail = NULL;
 	}	
 	*p_pid = msg_t->sender_pid;
-	msg = msg_t->msg;
+	TRACE(TRACE_RECV, current_pid, msg_t->sender_pid);
+	gp_current_process->m_stats.received++;
+	msg = k_msg_received(msg_t);
 	atomic_off();
-	k_release_memory_env((void*)msg_t);		
 	
 	
 	return msg;
 }
 
+/* Wake pid without a message: its next receive_message returns NULL once
+   the mailbox is empty. Needs no memory, so interrupt handlers can use it */
+void k_notify(int pid) {
+	atomic_on();
+	
+	gp_pcbs[pid]->m_notify = 1;
+	if (BLOCKED_ON_RECEIVE == gp_pcbs[pid]->m_state) {
+		gp_pcbs[pid]->m_state = RDY;
+		k_unblocked(gp_pcbs[pid]);
+		addQ(pid, gp_pcbs[pid]->m_priority);			
+		k_check_preemption();
+	}
+	
+	atomic_off();
+}
+
 /* This is a non-blocking receive */
 //returns NULL if no memory available
 void *k_receive_message_nb(int *p_pid) {
@@ -639,11 +1309,11 @@ void *k_receive_message_nb(int *p_pid) {
 		gp_pcbs[current_pid]->tail = NULL;
 	}	
 	*p_pid = msg_t->sender_pid;
-	msg_buf = msg_t->msg;
-	//msg_buf = msg_t->msg;
+	TRACE(TRACE_RECV, current_pid, msg_t->sender_pid);
+	gp_current_process->m_stats.received++;
+	msg_buf = k_msg_received(msg_t);
 	
 	atomic_off();
-	k_release_memory_env((void*)msg_t);		
 	
 	return msg_buf;
 }
@@ -15,6 +15,8 @@
 /* ----- Definitions ----- */
 
 #define INITIAL_xPSR 0x01000000        /* user process initial xPSR value */
+#define MIN_STACK_SIZE 0x100           /* smallest stack of a created process */
+#define NULL_PROC_STACK 0x100          /* stack of the null process */
 
 /* ----- Functions ----- */
 
@@ -22,8 +24,35 @@ void process_init(void);               /* initialize all procs in the system */
 PCB *scheduler(void);                  /* pick the pid of the next to run process */
 int k_release_process(void);           /* kernel release_process function */
 
+void addQ(int pid, int priority);      /* push pid to the tail of its ready queue */
+void removeQ(PCB *p_pcb, int priority);/* unlink a pcb from its ready queue */
+int inQ(PCB *p_pcb);                   /* 1 if the pcb is in a ready queue */
+int popQ(void);                        /* dequeue the highest priority ready pid */
+int peekQ(void);                       /* highest priority ready pid, not dequeued */
+void printQ(void);                     /* dump the ready queues */
+void addBlockedQ(int pid, int priority);/* wait for a memory block */
+int popBlockedQ(int slab);             /* first waiter for a block of size class slab */
+int removeBlockedQ(int pid);           /* unlink pid from the blocked queue */
+
+void k_pend_switch(void);              /* context switch on PendSV once ISRs are done */
+int k_check_preemption(void);          /* switch if a ready process outranks the current one */
+void k_unblocked(PCB *p_pcb);          /* trace and account a process leaving a blocked state */
+U32 proc_stack_total(void);            /* bytes the static process stacks will take */
+int k_get_process_stats(int pid, PROC_STATS *p_stats);
+void pcb_init(PCB *p_pcb, PROC_INIT *p_init, U32 *sp); /* reset a pcb and build its initial context */
+int k_create_process(void (*entry)(), int priority, int stack_size);
+int k_exit_process(void);
+int k_set_period(int period, int deadline, int wcet, int edf);
+int k_wait_next_period(void);
+void k_period_tick(void);              /* ready periodic processes due for release, from the timer IRQ */
+int k_next_release(void);              /* earliest periodic release, -1 if none */
+int outranks(PCB *a, PCB *b);          /* 1 if a runs before b */
+void k_notify(int pid);                /* wake a receiver without sending a message */
+void k_restart_call(void);             /* re-issue the blocked kernel call when resumed */
+U32 *k_context_switch(U32 *p_sp);      /* save p_sp, return the sp of the next process */
+U32 *k_saved_frame(PCB *p_pcb);        /* exception frame of a switched out process */
+
 extern U32 *alloc_stack(U32 size_b);   /* allocate stack for a process */
-extern void __rte(void);               /* pop exception stack frame */
 extern void set_test_procs(void);      /* test process initial set up */
 
 #endif /* ! K_PROCESS_H_ */
@@ -10,32 +10,13 @@
 
 /*----- Definitions -----*/
 
-#define RTX_ERR -1
+#include "rtx_def.h"
+
 #define RTX_OK  0
 
-#define NULL 0
-#define NUM_TEST_PROCS 6
-#define NUM_KERNEL_PROCS 2
-#define NUM_SYSTEM_PROCS 7
-#define NUM_PROCS 16		//everything above(15) + null proc(1)
-
-/* Process IDs */
-#define PID_NULL 0
-#define PID_P1   1
-#define PID_P2   2
-#define PID_P3   3
-#define PID_P4   4
-#define PID_P5   5
-#define PID_P6   6
-#define PID_A    7
-#define PID_B    8
-#define PID_C    9
-#define PID_SET_PRIO     10
-#define PID_CLOCK        11
-#define PID_KCD          12
-#define PID_CRT          13
-#define PID_TIMER_IPROC  14
-#define PID_UART_IPROC   15
+#define NUM_PRIORITIES 5	//HIGH..LOWEST plus the null process band
+
+#define IS_IPROC(pid) ((pid) == PID_TIMER_IPROC || (pid) == PID_UART_IPROC) /* runs in an interrupt, must not block */
 
 #ifdef DEBUG_0
 #define USR_SZ_STACK 0x200         /* user proc stack size 512B   */
@@ -45,12 +26,30 @@
 
 /*----- Types -----*/
 typedef unsigned char U8;
+typedef unsigned short U16;
 typedef unsigned int U32;
 
-#define NUM_MEM_BLOCKS 40
-
 /* process states, note we only assume three states in this example */
-typedef enum {NEW = 0, RDY, RUN, BLOCKED, BLOCKED_ON_RECEIVE, BLOCKED_ON_ENV} PROC_STATE_E;  
+typedef enum {NEW = 0, RDY, RUN, BLOCKED, BLOCKED_ON_RECEIVE, BLOCKED_ON_REPLY, EXITED, WAIT_PERIOD} PROC_STATE_E;  
+
+/* per process CPU accounting, times in us */
+typedef struct proc_stats
+{
+	U32 run_us;             /* time spent running */
+	U32 switches_vol;       /* switched out by blocking or release_processor */
+	U32 switches_invol;     /* preempted or time sliced */
+	U32 mem_us;             /* time blocked on a memory block */
+	U32 recv_us;            /* time blocked in receive_message or send_and_receive */
+	U32 sent;               /* messages sent */
+	U32 received;           /* messages received */
+	int state;              /* current PROC_STATE_E, filled in by get_process_stats */
+	U32 mem_used;           /* memory blocks it requested and are not released yet */
+	U32 mem_used_max;       /* high-water mark of mem_used */
+	U32 quota_hits;         /* requests that found it at its quota */
+	U32 misses;             /* periods finished after their deadline, see wait_next_period */
+	U32 lateness_max;       /* worst lateness in ms */
+	int priority;           /* current priority, filled in by get_process_stats */
+} PROC_STATS;
 
 /*
   PCB data structure definition.
@@ -58,21 +57,46 @@ typedef enum {NEW = 0, RDY, RUN, BLOCKED, BLOCKED_ON_RECEIVE, BLOCKED_ON_ENV} PR
   in order to finish P1 and the entire project 
 */
 
+/* routing header the kernel keeps in front of every memory block, see k_msg_header */
 typedef struct msg_t{
-	void* msg;
+	void* msg;              /* the block it carries, itself unless it is a proxy */
 	struct msg_t* next;
-	int dest_pid;
+	int dest_pid;           /* -1 while the block is not queued */
 	int sender_pid;	
 	int delay;
 } MSG_T;
 
+#define MSG_HDR(p_blk) ((MSG_T *)(p_blk) - 1)   /* header of a block */
+#define MSG_DATA(p_hdr) ((void *)((p_hdr) + 1)) /* block behind a header */
+
 typedef struct pcb 
 { 
-	//struct pcb *mp_next;  /* next pcb, not used in this example */  
+	struct pcb *mp_next;  /* next pcb in the ready queue of its priority */
+	struct pcb *mp_prev;  /* previous pcb in the ready queue of its priority */
 	U32 *mp_sp;		/* stack pointer of the process */
 	U32 m_pid;		/* process id */
 	PROC_STATE_E m_state;   /* state of the process */      
 	int m_priority;
+	int m_quantum;          /* time slice in ms, 0 never time slices */
+	int m_slice_left;       /* ms left in the current time slice */
+	int m_reply_from;       /* pid expected to reply while BLOCKED_ON_REPLY */
+	int m_notify;           /* pending notification, see k_notify */
+	PROC_STATS m_stats;
+	U32 m_since;            /* us timestamp of the last switch in or block */
+	PROC_STATE_E m_blocked_in; /* state it blocked in, NEW while not accounted */
+	int m_wait_slab;        /* size class it is blocked on for a block */
+	int m_mem_quota;        /* see PROC_INIT */
+	int m_mem_reserve;
+	int m_mem_block;        /* 128 byte blocks of mem_used, counted against m_mem_reserve */
+	U32 *mp_stack_top;      /* stack of a created process, returned by exit_process */
+	U32 m_stack_size;       /* its size in bytes, 0 for the static processes */
+	int m_edf;              /* ready by earliest deadline, ahead of every priority */
+	U32 m_period;           /* ms between releases, 0 if not periodic */
+	U32 m_rel_deadline;     /* ms after a release its work is due */
+	U32 m_util;             /* admitted EDF load in 1/1000 */
+	U32 m_release;          /* g_timer_count of the current release */
+	U32 m_deadline;         /* absolute deadline of the current release */
+	struct pcb *mp_wait_next; /* release list while WAIT_PERIOD */
 	MSG_T* head;
 	MSG_T* tail;
 } PCB;
@@ -84,6 +108,9 @@ typedef struct proc_init
 	int m_priority;         /* initial priority, not used in this example. */ 
 	int m_stack_size;       /* size of stack in words */
 	void (*mpf_start_pc) ();/* entry point of the process */    
+	int m_quantum;          /* round-robin time slice in ms, 0 never time slices */
+	int m_mem_quota;        /* most memory blocks it may hold, 0 for no limit */
+	int m_mem_reserve;      /* 128 byte blocks kept free for it alone */
 } PROC_INIT;
 
 //kernel copy
@@ -94,11 +121,4 @@ typedef struct msgbuf
 	char mtext[32];          /* body of the message */	
 } MSG_BUF;
 
-/* Message Types */
-#define DEFAULT 0
-#define KCD_REG 1
-#define COUNT_REPORT 2
-#define WAKEUP10 3
-#define CLOCK 4
-
 #endif // ! K_RTX_H_
@@ -5,6 +5,7 @@
  * @date:   2014/01/17
  */
 
+#include <LPC17xx.h>
 #include "k_rtx_init.h"
 #include "uart_polling.h"
 #include "k_memory.h"
@@ -16,6 +17,10 @@ void k_rtx_init(void)
         uart0_init();   
 				memory_init();
         process_init();
+        
+        /* PendSV does the context switches requested by interrupt handlers,
+           it must never preempt another handler */
+        NVIC_SetPriority(PendSV_IRQn, (1 << __NVIC_PRIO_BITS) - 1);
         __enable_irq();
 	
 	/* start the first process */
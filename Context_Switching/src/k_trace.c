@@ -0,0 +1,92 @@
+/**
+ * @file:   k_trace.c
+ * @brief:  scheduling trace ring, see k_trace.h
+ */
+
+#include <LPC17xx.h>
+#include "k_trace.h"
+#include "timer.h"
+#include "uart.h"
+
+extern volatile uint32_t g_timer_count;
+
+TRACE_EVENT g_trace[TRACE_SIZE];
+volatile uint32_t g_trace_head = 0;     /* total number of events recorded */
+volatile int g_trace_on = 1;
+
+/* dump in progress: "\r\n@TRACE", event count, ticks per ms, then the events */
+#define TRACE_HDR_SIZE 16
+uint8_t g_trace_hdr[TRACE_HDR_SIZE] = {'\r', '\n', '@', 'T', 'R', 'A', 'C', 'E'};
+uint32_t g_trace_dump_first;    /* oldest event of the dump */
+uint32_t g_trace_dump_pos;      /* bytes sent */
+uint32_t g_trace_dump_len = 0;  /* bytes to send, 0 if no dump is running */
+
+/* safe from any context, a slot is reserved with LDREX/STREX */
+void trace_event(int type, int pid, int arg) {
+	uint32_t slot;
+	TRACE_EVENT *ev;
+	
+	do {
+		slot = __LDREXW(&g_trace_head);
+	} while (__STREXW(slot + 1, &g_trace_head));
+	
+	ev = &g_trace[slot & (TRACE_SIZE - 1)];
+	ev->ms = g_timer_count;
+	ev->ticks = timer_ticks();
+	ev->type = type;
+	ev->pid = pid;
+	ev->arg = arg;
+}
+
+void put_u32(uint8_t *p, uint32_t v) {
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+/* freeze the ring and have the UART i-process send it */
+void trace_dump(void) {
+	LPC_UART_TypeDef *pUart = (LPC_UART_TypeDef *) LPC_UART0;
+	uint32_t count;
+	
+	if (g_trace_dump_len != 0) {
+		return;
+	}
+	g_trace_on = 0;
+	
+	count = g_trace_head < TRACE_SIZE ? g_trace_head : TRACE_SIZE;
+	g_trace_dump_first = g_trace_head - count;
+	put_u32(&g_trace_hdr[8], count);
+	put_u32(&g_trace_hdr[12], TRACE_TICKS_PER_MS);
+	g_trace_dump_pos = 0;
+	g_trace_dump_len = TRACE_HDR_SIZE + count * sizeof(TRACE_EVENT);
+	
+	pUart->IER = IER_THRE | IER_RLS | IER_RBR;
+}
+
+/* write up to room bytes of the dump to THR, called on THRE by the UART
+   i-process. Returns the bytes written, tracing resumes after the last one */
+int trace_dump_fill(int room) {
+	LPC_UART_TypeDef *pUart = (LPC_UART_TypeDef *) LPC_UART0;
+	int n = 0;
+	
+	while (n < room && g_trace_dump_pos < g_trace_dump_len) {
+		uint32_t pos = g_trace_dump_pos++;
+		
+		if (pos < TRACE_HDR_SIZE) {
+			pUart->THR = g_trace_hdr[pos];
+		} else {
+			pos -= TRACE_HDR_SIZE;
+			pUart->THR = ((uint8_t *)&g_trace[(g_trace_dump_first + pos / sizeof(TRACE_EVENT)) & (TRACE_SIZE - 1)])
+				[pos % sizeof(TRACE_EVENT)];
+		}
+		n++;
+	}
+	
+	if (g_trace_dump_len != 0 && g_trace_dump_pos == g_trace_dump_len) {
+		g_trace_dump_len = 0;
+		g_trace_on = 1;
+	}
+	return n;
+}
@@ -0,0 +1,45 @@
+/**
+ * @file:   k_trace.h
+ * @brief:  always-on scheduling trace. Events overwrite the oldest ones in a
+ *          fixed ring, the %DT command dumps the ring in binary over the UART
+ *          and tools/trace2chrome.c converts the dump into Chrome trace JSON.
+ */
+
+#ifndef K_TRACE_H_
+#define K_TRACE_H_
+
+#include <stdint.h>
+
+#define TRACE_SIZE 256          /* events, power of 2 */
+#define TRACE_TICKS_PER_MS 25000    /* PCLK ticks of TIMER0 per ms */
+
+/* event types, arg in brackets */
+#define TRACE_SWITCH    1   /* pid switched in (pid switched out) */
+#define TRACE_BLOCK     2   /* pid blocked (PROC_STATE_E it blocked in) */
+#define TRACE_UNBLOCK   3   /* pid made ready */
+#define TRACE_SEND      4   /* pid sent (receiver pid) */
+#define TRACE_RECV      5   /* pid received (sender pid) */
+#define TRACE_ALLOC     6   /* pid got (memory block index) */
+#define TRACE_FREE      7   /* pid released (memory block index) */
+#define TRACE_IRQ_ENTER 8   /* i-process pid entered (IRQn) */
+#define TRACE_IRQ_EXIT  9   /* i-process pid left (IRQn) */
+
+/* 12 bytes, dumped as is (little endian) */
+typedef struct trace_event {
+	uint32_t ms;        /* g_timer_count */
+	uint32_t ticks;     /* PCLK ticks since the last timer interrupt */
+	uint8_t type;
+	uint8_t pid;
+	uint16_t arg;
+} TRACE_EVENT;
+
+extern volatile int g_trace_on;
+extern uint32_t g_trace_dump_len;
+
+void trace_event(int type, int pid, int arg);
+void trace_dump(void);
+int trace_dump_fill(int room);
+
+#define TRACE(type, pid, arg) do { if (g_trace_on) trace_event(type, pid, arg); } while (0)
+
+#endif /* ! K_TRACE_H_ */
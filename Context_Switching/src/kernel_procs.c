@@ -1,7 +1,11 @@
 #include <LPC17xx.h>
 #include "kernel_procs.h"
 #include "k_process.h"
+#include "k_memory.h"
 #include "k_rtx.h"
+#include "system_proc.h"
+#include "k_log.h"
+#include "k_trace.h"
 #include "uart.h"
 #include "uart_polling.h"
 #ifdef DEBUG_0
@@ -10,22 +14,34 @@
 #endif /* DEBUG_0 */
 
 extern uint32_t g_timer_count;
-extern int processQueue[5][NUM_PROCS]; 
-extern int blockedQueue[5][NUM_PROCS];
+extern int blockedQueue[5][MAX_PROCS];
 extern PCB **gp_pcbs;  
-extern int flag[NUM_MEM_BLOCKS];
+extern U32 g_preempt_switches;
+extern U32 g_slices_forced;
+extern U32 g_slices_voluntary;
+extern U32 g_preempt_avoided;
 
 PROC_INIT g_kernel_procs[NUM_KERNEL_PROCS];
 
-//head and tail of the timeout queue
-MSG_T* timer_head = NULL;
-MSG_T* timer_tail = NULL; 
+//timing wheel of delayed messages, msg->delay holds the absolute expiry time.
+//level 0 has one slot per ms, each level 1 slot covers one turn of level 0
+//and each level 2 slot one turn of level 1. A slot is cascaded into the
+//level below when the level below wraps around
+TIMER_SLOT g_wheel0[WHEEL0_SIZE];
+TIMER_SLOT g_wheel1[WHEELN_SIZE];
+TIMER_SLOT g_wheel2[WHEELN_SIZE];
+TIMER_SLOT g_wheel_overflow;   //beyond level 2, looked at again each turn of level 2
+U32 g_wheel_time = 0;    //next ms the wheel has to process
+int g_wheel_pending = 0; //number of messages in the wheel
 
 void set_kernel_procs() {	
 	int i;
 	for( i = 0; i < NUM_KERNEL_PROCS; i++ ) {
 		g_kernel_procs[i].m_priority=0;
 		g_kernel_procs[i].m_stack_size=0x100;
+		g_kernel_procs[i].m_quantum=0;
+		g_kernel_procs[i].m_mem_quota=0;
+		g_kernel_procs[i].m_mem_reserve=0;
 	}
 	
 	g_kernel_procs[0].mpf_start_pc = &timer_i_process;
@@ -34,67 +50,313 @@ void set_kernel_procs() {
 	g_kernel_procs[1].m_pid = PID_UART_IPROC;
 }
 
+//slot of the wheel an expiry time belongs to, relative to g_wheel_time
+TIMER_SLOT *wheel_slot(U32 expires) {
+	U32 diff;
+	
+	if ((int)(expires - g_wheel_time) < 0) {
+		expires = g_wheel_time;		//already due, expire on the next ms processed
+	}
+	diff = expires - g_wheel_time;
+	
+	if (diff < WHEEL0_SIZE) {
+		return &g_wheel0[expires & (WHEEL0_SIZE - 1)];
+	} else if (diff < (WHEEL0_SIZE << WHEELN_BITS)) {
+		return &g_wheel1[(expires >> WHEEL0_BITS) & (WHEELN_SIZE - 1)];
+	} else if (diff < (WHEEL0_SIZE << (2 * WHEELN_BITS))) {
+		return &g_wheel2[(expires >> (WHEEL0_BITS + WHEELN_BITS)) & (WHEELN_SIZE - 1)];
+	}
+	return &g_wheel_overflow;
+}
+
+//append to the tail of its slot, equal deadlines stay in FIFO order
+void wheel_add(MSG_T* msg_t) {
+	TIMER_SLOT *slot = wheel_slot((U32)msg_t->delay);
+	
+	msg_t->next = NULL;
+	if (slot->tail != NULL) {
+		slot->tail->next = msg_t;
+	} else {
+		slot->head = msg_t;
+	}
+	slot->tail = msg_t;
+}
+
+//move every message of slot down a level. Messages cascading into a slot were
+//sent before the ones already there, so they are put in front, in their own order.
+//Lower levels are cascaded first for the same reason
+void wheel_cascade(TIMER_SLOT *slot) {
+	MSG_T* node = slot->head;
+	MSG_T* reversed = NULL;
+	
+	slot->head = NULL;
+	slot->tail = NULL;
+	
+	while (node) {
+		MSG_T* next = node->next;
+		node->next = reversed;
+		reversed = node;
+		node = next;
+	}
+	
+	while (reversed) {
+		MSG_T* next = reversed->next;
+		TIMER_SLOT *target = wheel_slot((U32)reversed->delay);
+		
+		reversed->next = target->head;
+		target->head = reversed;
+		if (target->tail == NULL) {
+			target->tail = reversed;
+		}
+		reversed = next;
+	}
+}
+
 void timer_i_process() {
-	MSG_T* it;
 	MSG_T* node;	
-	MSG_T* temp;
 	MSG_T* msg_t;
 	
 	atomic_on();
 	
+	//nothing to expire, catch up in one step (e.g. after a tickless idle period).
+	//This has to happen before new messages are placed relative to g_wheel_time,
+	//a slot picked from a stale g_wheel_time may be one whose cascade is skipped
+	if (g_wheel_pending == 0) {
+		g_wheel_time = g_timer_count;
+	}
+	
 	msg_t = (MSG_T*)k_receive_message_t();
 	
 	while(msg_t) {				
 		msg_t->delay = msg_t->delay + g_timer_count;
-		it = timer_head;
-		msg_t->next = NULL;
+		wheel_add(msg_t);
+		g_wheel_pending++;
 		
-		if (NULL == timer_head) {				//0 nodes
-			timer_head = msg_t;
-			timer_tail = msg_t;
-			//msg_t->next = NULL;
-		} else if (msg_t->delay < timer_head->delay) {		//one node
-			msg_t->next = timer_head;
-			timer_head = msg_t;
-		} else {									
-			while(it->next && it->next->delay < msg_t->delay) {			//more than 1 node
-				it = it->next;
-			}
-			msg_t->next = it->next;
-			it->next = msg_t;			
+		msg_t = (MSG_T*) k_receive_message_t();		
+	}
+	
+	while ((int)(g_timer_count - g_wheel_time) >= 0) {
+		U32 index = g_wheel_time & (WHEEL0_SIZE - 1);
+		
+		if (index == 0) {
+			U32 index1 = (g_wheel_time >> WHEEL0_BITS) & (WHEELN_SIZE - 1);
+			U32 index2 = (g_wheel_time >> (WHEEL0_BITS + WHEELN_BITS)) & (WHEELN_SIZE - 1);
 			
-			if (it->next == NULL) {
-				timer_tail = it;
+			wheel_cascade(&g_wheel1[index1]);
+			if (index1 == 0) {
+				wheel_cascade(&g_wheel2[index2]);
+				if (index2 == 0) {
+					wheel_cascade(&g_wheel_overflow);
+				}
 			}
-		}				
+		}
 		
-		msg_t = (MSG_T*) k_receive_message_t();		
+		node = g_wheel0[index].head;
+		g_wheel0[index].head = NULL;
+		g_wheel0[index].tail = NULL;
+		while (node) {		
+			MSG_T* next = node->next;	
+			send_message_t(node);						
+			g_wheel_pending--;
+			node = next;				
+		}	
+		
+		g_wheel_time++;
 	}
 	
-	node = timer_head;
-	while (node && node->delay <= g_timer_count) {		
-		MSG_T* next = node->next;	
-		send_message_t(node);						
-		node = next;				
-	}	
+	atomic_off();
+}
+
+//unlink and drop the messages for pid from a list, returns how many there were
+int msg_purge(MSG_T** p_head, MSG_T** p_tail, int pid) {
+	MSG_T* node = *p_head;
+	MSG_T* prev = NULL;
+	int n = 0;
 	
-	timer_head = node;		
+	while (node) {
+		MSG_T* next = node->next;
+		
+		if (node->dest_pid == pid) {
+			if (prev != NULL) {
+				prev->next = next;
+			} else {
+				*p_head = next;
+			}
+			if (*p_tail == node) {
+				*p_tail = prev;
+			}
+			k_msg_drop(node);
+			n++;
+		} else {
+			prev = node;
+		}
+		node = next;
+	}
+	return n;
+}
+
+//a new process can get the pid at once, it must not inherit these
+void timer_purge(int pid) {
+	int i;
+	
+	atomic_on();
+	
+	msg_purge(&gp_pcbs[PID_TIMER_IPROC]->head, &gp_pcbs[PID_TIMER_IPROC]->tail, pid);
+	for (i = 0; i < WHEEL0_SIZE; i++) {
+		g_wheel_pending -= msg_purge(&g_wheel0[i].head, &g_wheel0[i].tail, pid);
+	}
+	for (i = 0; i < WHEELN_SIZE; i++) {
+		g_wheel_pending -= msg_purge(&g_wheel1[i].head, &g_wheel1[i].tail, pid);
+		g_wheel_pending -= msg_purge(&g_wheel2[i].head, &g_wheel2[i].tail, pid);
+	}
+	g_wheel_pending -= msg_purge(&g_wheel_overflow.head, &g_wheel_overflow.tail, pid);
 	
 	atomic_off();
 }
 
+int timer_next_deadline(void) {
+	U32 t;
+	U32 boundary;
+	
+	//delayed messages still in the mailbox are added on the next tick
+	if (gp_pcbs[PID_TIMER_IPROC]->head != NULL) {
+		return g_timer_count;
+	}
+	if (g_wheel_pending == 0) {
+		return -1;
+	}
+	
+	//level 0 is exact up to the next cascade, wake up there otherwise
+	boundary = (g_wheel_time + WHEEL0_SIZE) & ~(WHEEL0_SIZE - 1);
+	for (t = g_wheel_time; t != boundary; t++) {
+		if (g_wheel0[t & (WHEEL0_SIZE - 1)].head != NULL) {
+			return t;
+		}
+	}
+	return boundary;
+}
+
 uint8_t g_buffer[]= "You Typed a Q\n\r";
 uint8_t *gp_buffer = g_buffer;
 uint8_t g_send_char = 0;
 uint8_t g_char_in;
 uint8_t g_char_out;
 
-uint8_t bBuffer[32];
-int index = 0;
-int ready_new = 1;
-uint8_t *bPtr;
-uint8_t bChar;
+//message block being transmitted, sent straight out of mtext
+MSG_BUF *gp_tx_msg = NULL;
+int g_tx_pos = 0;
+int g_tx_size = 0;      //mtext bytes of gp_tx_msg
+int g_log_tx_mid = 0;   //a log frame was cut short by a full FIFO
+U32 g_uart_tx_irqs = 0;
+
+
+//UART receive statistics
+U32 g_uart_rx_bytes = 0;
+U32 g_uart_rx_irqs = 0;
+U32 g_uart_rx_overruns = 0;
+U32 g_uart_rx_dropped = 0;
+
+#ifdef _DEBUG_HOTKEYS
+//hotkeys pressed since the last dump, one bit per character of HOTKEYS.
+//The interrupt only records them, KCD prints the dumps in process context
+#define HOTKEYS "!@#&"
+volatile U32 g_hotkeys = 0;
+
+void hotkey_dump(void) {
+	U32 keys;
+	int i = 0;
+	int k = 0;
+	int j;
+	
+	atomic_on();
+	keys = g_hotkeys;
+	g_hotkeys = 0;
+	atomic_off();
+	
+	if (keys & BIT(0)) {
+		printQ();
+	}
+	if (keys & BIT(1)) {
+		printf("Process Blocked Queue \r\n");
+		for (i = 0; i < 5; i++) {
+			for (k = 0; k < MAX_PROCS; k++) {		
+				if (blockedQueue[i][k] == -1) {
+					printf("_  ");
+				} else if (blockedQueue[i][k] / 10 >= 1){
+					printf("%d ", blockedQueue[i][k]);
+				} else {
+					printf("%d  ", blockedQueue[i][k]);
+				}
+			}
+			printf("\r\n");
+		}		
+	}
+	if (keys & BIT(2)) {
+		printf("Process Blocked On Receive Queue \r\n");
+		for (k = 0; k < MAX_PROCS; k++) {		
+			if (gp_pcbs[k]->m_state == BLOCKED_ON_RECEIVE) {
+				printf("pid: %d priority: %d \r\n", gp_pcbs[k]->m_pid, gp_pcbs[k]->m_priority);
+			}
+		}
+		printf("\r\n");
+	}
+	if (keys & BIT(3)) {
+		printf("Process Memory assignment \r\n");							
+		for (j = 0; j < g_slab_slots; j++) {
+			if (flag[j] != 0) {
+				//MSG_BUF* buf = (MSG_BUF*) flag[j];
+				
+				printf("%d has a memory block of msg type\r\n", flag[j]);
+			}
+		}
+		//waste is the unused tail of the blocks in use, idle the RAM above the high-water mark
+		for (j = 0; j < SLAB_CLASSES; j++) {
+			SLAB_CLASS *slab = &g_slab[j];
+			printf("slab %d: %d/%d free, high-water %d, %d blocked, %d failed, waste %d (max %d) idle %d bytes\r\n", 
+				slab->block_size, slab->free_count, slab->count, slab->used_max, slab->blocked, slab->failures, 
+				slab->waste, slab->waste_max, (slab->count - slab->used_max) * slab->block_size);
+		}
+		printf("i-process reserve: %d proxies, %d blocks, %d/%d hits, %d/%d exhausted\r\n", g_slab[SLAB_TINY].irq_reserve, 
+			g_slab[SLAB_BLOCK].irq_reserve, g_slab[SLAB_TINY].irq_hits, g_slab[SLAB_BLOCK].irq_hits, 
+			g_slab[SLAB_TINY].irq_exhausted, g_slab[SLAB_BLOCK].irq_exhausted);
+		printf("reservations: %d blocks of %d bytes held back\r\n", g_mem_reserve_left, SLAB_BLOCK_SIZE);
+		printf("time slices: %d used up (quantum %d ms), %d given up early\r\n", g_slices_forced, RR_QUANTUM, g_slices_voluntary);
+		printf("preemption: %d wake-ups switched, %d kept the running process\r\n", g_preempt_switches, g_preempt_avoided);
+		printf("uart rx: %d bytes, %d interrupts, %d overruns\r\n", g_uart_rx_bytes, g_uart_rx_irqs, g_uart_rx_overruns);
+		printf("uart tx: %d interrupts\r\n", g_uart_tx_irqs);
+		printf("uart rx ring: %d bytes waiting, %d dropped\r\n", g_uart_rx_head - g_uart_rx_tail, g_uart_rx_dropped);
+		printf("log: %d records dropped\r\n", g_log_dropped);
+		printf("crt: %d bytes in %d kicks, up to %d messages per kick, ring high-water %d/%d, %d forwarded\r\n", 
+			g_crt_bytes, g_crt_kicks, g_crt_batch_max, g_crt_ring_max, CRT_RING_SIZE, g_crt_fwd_sent);
+		printf("------------------------------\r\n");
+	}
+}
+#endif /* _DEBUG_HOTKEYS */
 
+//queue one received character for KCD, returns 1 if it was queued
+int uart_rx_char(U8 c) {
+	#ifdef _DEBUG_HOTKEYS
+	char *key;
+	
+	for (key = HOTKEYS; *key != '\0'; key++) {
+		if (c == *key) {
+			g_hotkeys |= BIT(key - HOTKEYS);
+			return 1;	//wakes KCD
+		}
+	}
+	#endif
+	
+	/*************************/	
+	if (g_uart_rx_head - g_uart_rx_tail == UART_RX_SIZE) {
+		g_uart_rx_dropped++;
+		LOG1(LOG_UART_DROPPED, c);
+		return 0;
+	}
+	g_uart_rx[g_uart_rx_head & (UART_RX_SIZE - 1)] = c;
+	g_uart_rx_head++;
+	return 1;
+	/*************************/
+}
 
 void uart_i_process(void) {
 
@@ -102,147 +364,105 @@ void uart_i_process(void) {
 	LPC_UART_TypeDef *pUart = (LPC_UART_TypeDef *)LPC_UART0;
 	
 	/* Reading IIR automatically acknowledges the interrupt */
-	IIR_IntId = (pUart->IIR) >> 1 ; // skip pending bit in IIR 
-	if (IIR_IntId & IIR_RDA) { // Receive Data Avaialbe
-		MSG_BUF *msg;				
-		int i = 0;
-		int k = 0;
-		
-		/* read UART. Read RBR will clear the interrupt */
-		g_char_in = pUart->RBR;		
+	IIR_IntId = ((pUart->IIR) >> 1) & 0x07; // skip pending bit in IIR 
+	if (IIR_IntId == IIR_RDA || IIR_IntId == IIR_CTI || IIR_IntId == IIR_RLS) { 
+		// Receive Data Available, Character Time-out or Line Status:
+		// drain the whole RX FIFO, reading LSR also clears the line status
+		uint8_t lsr = pUart->LSR;
+		int queued = 0;
 		
-		#ifdef _DEBUG_HOTKEYS
-		if (g_char_in == '!') {		
-			printf("Process Ready Queue \r\n");
-			for (i = 0; i < 5; i++) {
-				for (k = 0; k < NUM_PROCS; k++) {		
-					if (processQueue[i][k] == -1) {
-						printf("_  ");
-					} else if (processQueue[i][k] / 10 >= 1){
-						printf("%d ", processQueue[i][k]);
-					} else {
-						printf("%d  ", processQueue[i][k]);
-					}
-				}
-				printf("\r\n");
+		g_uart_rx_irqs++;
+		while (lsr & LSR_RDR) {
+			if (lsr & LSR_OE) {
+				g_uart_rx_overruns++;
+				LOG1(LOG_UART_OVERRUN, g_uart_rx_bytes);
 			}
-			return;
-		} else if (g_char_in == '@') {
-			printf("Process Blocked Queue \r\n");
-			for (i = 0; i < 5; i++) {
-				for (k = 0; k < NUM_PROCS; k++) {		
-					if (blockedQueue[i][k] == -1) {
-						printf("_  ");
-					} else if (blockedQueue[i][k] / 10 >= 1){
-						printf("%d ", blockedQueue[i][k]);
-					} else {
-						printf("%d  ", blockedQueue[i][k]);
-					}
-				}
-				printf("\r\n");
-			}		
-			return;
-		} else if (g_char_in == '#') {
-			printf("Process Blocked On Receive Queue \r\n");
-			for (k = 0; k < NUM_PROCS; k++) {		
-				if (gp_pcbs[k]->m_state == BLOCKED_ON_RECEIVE) {
-					printf("pid: %d priority: %d \r\n", gp_pcbs[k]->m_pid, gp_pcbs[k]->m_priority);
-				}
-			}
-			printf("\r\n");
-			return;
-		} else if (g_char_in == '$') {
-			printf("Process Blocked On Envelope Queue \r\n");
-			for (i = 0; i < 5; i++) {
-				for (k = 0; k < NUM_PROCS; k++) {
-					int pidz = blockedQueue[i][k];
-					if (pidz == -1 || gp_pcbs[pidz]->m_state != BLOCKED_ON_ENV) {
-						printf("_  ");
-					} else if (pidz / 10 >= 1){
-						printf("%d ", pidz);
-					} else {
-						printf("%d  ", pidz);
-					}
-				}
-				printf("\r\n");
-			}	
-			return;
-		} else if (g_char_in == '&') {
-			int j;
-			printf("Process Memory assignment \r\n");							
-			for (j = 0; j < NUM_MEM_BLOCKS; j++) {
-				if (flag[j] != 0) {
-					//MSG_BUF* buf = (MSG_BUF*) flag[j];
-					
-					printf("%d has a memory block of msg type\r\n", flag[j]);
-				}
-			}
-			printf("------------------------------\r\n");
-			return;
-		}	
-		#endif
-		
-		/*************************/	
-		msg = (MSG_BUF*)k_request_memory_block();		
-		if (msg == NULL) {
-			return;
+			/* read UART. Read RBR will clear the interrupt */
+			g_char_in = pUart->RBR;		
+			g_uart_rx_bytes++;
+			queued += uart_rx_char(g_char_in);
+			lsr = pUart->LSR;
+		}
+		if (lsr & LSR_OE) {
+			g_uart_rx_overruns++;
+			LOG1(LOG_UART_OVERRUN, g_uart_rx_bytes);
 		}
+		if (queued) {
+			k_notify(PID_KCD);
+		}
+	} else if (IIR_IntId == IIR_THRE) {
+	/* THRE Interrupt, transmit holding register becomes empty:
+	   refill the whole TX FIFO from the queued message blocks */
+		/*************************/		
+		int sender;
+		int n = 0;
 		
-		msg->mtype = DEFAULT;
-		(msg->mtext)[0] = g_char_in;
-		(msg->mtext)[1] = '\0';
-		k_send_message(PID_KCD, msg);		
-		/*************************/
+		g_uart_tx_irqs++;
+		// a trace dump is binary and goes out alone
+		n = trace_dump_fill(UART_TX_FIFO_SIZE);
+		if (g_trace_dump_len != 0) {
+			n = UART_TX_FIFO_SIZE;
+		}
 		
+		// echo goes out ahead of everything else
+		while (n < UART_TX_FIFO_SIZE && g_echo_tail != g_echo_head) {
+			pUart->THR = g_echo[g_echo_tail & (UART_ECHO_SIZE - 1)];
+			g_echo_tail++;
+			n++;
+		}
 		
-	} 
-	if (IIR_IntId & IIR_THRE) {
-	//if (pUart->LSR & LSR_THRE) {
-	/* THRE Interrupt, transmit holding register becomes empty */
-		/*************************/		
-		int sender;
-		int i;
-		MSG_BUF* msg;
+		// finish a log frame before other output can split it
+		while (n < UART_TX_FIFO_SIZE && g_log_tx_mid && g_log_tx_tail != g_log_tx_head) {
+			uint8_t c = g_log_tx[g_log_tx_tail & (LOG_TX_SIZE - 1)];
+			pUart->THR = c;
+			g_log_tx_tail++;
+			g_log_tx_mid = (c != '\n');
+			n++;
+		}
 		
-		if (ready_new) {
-			msg = (MSG_BUF*) k_receive_message_nb(&sender);	
+		// CRT output ring next, it is always older than forwarded blocks
+		while (n < UART_TX_FIFO_SIZE && g_crt_tail != g_crt_head) {
+			pUart->THR = g_crt_ring[g_crt_tail & CRT_RING_MASK];
+			g_crt_tail++;
+			n++;
+		}
 		
-			if (msg != NULL) {
-				char* msg_str = msg->mtext;		
-				ready_new = 0;
-				index = 0;
-				
-				for(i=0; i<31 && msg->mtext[i] !='\0'; i++)
-					bBuffer[i] = msg->mtext[i];
-				
-				bBuffer[i] =  '\0';
-				
-				if (CLOCK != msg->mtype) {
-					k_release_memory_block(msg);
+		while (n < UART_TX_FIFO_SIZE) {
+			if (gp_tx_msg == NULL) {
+				gp_tx_msg = (MSG_BUF*) k_receive_message_nb(&sender);
+				g_tx_pos = 0;
+				if (gp_tx_msg == NULL) {
+					break;
 				}
+				g_tx_size = k_mtext_size(gp_tx_msg);
+			}
+			
+			if (g_tx_pos < g_tx_size && gp_tx_msg->mtext[g_tx_pos] != '\0') {
+				pUart->THR = gp_tx_msg->mtext[g_tx_pos++];
+				n++;
+			} else {
+				// last byte is queued, the block can go
+				if (CLOCK != gp_tx_msg->mtype) {
+					k_release_memory_block(gp_tx_msg);
+				}
+				gp_tx_msg = NULL;
+				g_crt_fwd_done++;
 			}
-		} 
-		
-		if (bBuffer[index] != '\0') {
-			pUart->THR = bBuffer[index++];
 		}
-		else if (bBuffer[index] == '\0') {
-			pUart->THR = bBuffer[index];
-			ready_new = 1;
-			index = 0;
-			if (gp_pcbs[PID_UART_IPROC]->head == NULL) {
-				pUart->IER ^= IER_THRE; // toggle the IER_THRE bit
-			}				
+		
+		// deferred log last, when there is nothing else to send
+		while (n < UART_TX_FIFO_SIZE && gp_tx_msg == NULL && g_log_tx_tail != g_log_tx_head) {
+			uint8_t c = g_log_tx[g_log_tx_tail & (LOG_TX_SIZE - 1)];
+			pUart->THR = c;
+			g_log_tx_tail++;
+			g_log_tx_mid = (c != '\n');
+			n++;
 		}
 		
-			/*
-		pUart->IER ^= IER_THRE; // toggle the IER_THRE bit 
-		pUart->THR = '\0';
-		g_send_char = 0;
-		gp_buffer = g_buffer;		
-	      */
+		if (g_trace_dump_len == 0 && g_echo_tail == g_echo_head && g_crt_tail == g_crt_head && gp_tx_msg == NULL && gp_pcbs[PID_UART_IPROC]->head == NULL
+				&& g_log_tx_tail == g_log_tx_head) {
+			pUart->IER &= ~IER_THRE; // nothing left to send
+		}
+		/*************************/
 	}
 }
-
-
-
@@ -2,10 +2,28 @@
 #define KERNEL_PROC_H_   
 #include "k_rtx.h"
 
+/* timing wheel for delayed messages: 256 x 1 ms, 64 x 256 ms, 64 x 16384 ms */
+#define WHEEL0_BITS 8
+#define WHEEL0_SIZE (1 << WHEEL0_BITS)
+#define WHEELN_BITS 6
+#define WHEELN_SIZE (1 << WHEELN_BITS)
+
+typedef struct timer_slot {
+	MSG_T* head;
+	MSG_T* tail;
+} TIMER_SLOT;
+
 void set_kernel_procs(void);
 
 //kernel interrupt processes
 void timer_i_process(void);
 void uart_i_process(void);
+int uart_rx_char(U8 c);
+
+//g_timer_count of the earliest delayed message, -1 if there is none
+int timer_next_deadline(void);
+
+//drop the delayed messages still on their way to pid, for exit_process
+void timer_purge(int pid);
 
 #endif
@@ -0,0 +1,14 @@
+/**
+ * @file:   log_fmt.h
+ * @brief:  format table of the deferred log, one LOG_FMT(id, format) per message.
+ *          k_log.h expands it into the ids, tools/log_decode.c into the strings.
+ *          Append new entries at the end and use at most LOG_MAX_ARGS arguments.
+ */
+
+LOG_FMT(LOG_SWITCH,        "switch %u -> %u")
+LOG_FMT(LOG_PREEMPT,       "preempt %u for %u")
+LOG_FMT(LOG_SLICE,         "time slice of %u expired")
+LOG_FMT(LOG_MEM_BLOCKED,   "pid %u blocked on memory")
+LOG_FMT(LOG_MEM_FAILED,    "pid %u memory request failed")
+LOG_FMT(LOG_UART_OVERRUN,  "uart rx overrun after %u bytes")
+LOG_FMT(LOG_UART_DROPPED,  "uart rx ring full, dropped 0x%02x")
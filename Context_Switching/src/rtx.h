@@ -6,12 +6,7 @@
 #define RTX_H_
 
 /* ----- Definitations ----- */
-#define RTX_ERR -1
-#define NULL 0
-#define NUM_TEST_PROCS 6
-#define NUM_KERNEL_PROCS 2
-#define NUM_SYSTEM_PROCS 7
-#define NUM_PROCS 16		//everything above(15) + null proc(1)
+#include "rtx_def.h"
 
 /* Process Priority. The bigger the number is, the lower the priority is*/
 #define HIGH    0
@@ -19,33 +14,6 @@
 #define LOW     2
 #define LOWEST  3
 
-/* Process IDs */
-#define PID_NULL 0
-#define PID_P1   1
-#define PID_P2   2
-#define PID_P3   3
-#define PID_P4   4
-#define PID_P5   5
-#define PID_P6   6
-#define PID_A    7
-#define PID_B    8
-#define PID_C    9
-#define PID_SET_PRIO     10
-#define PID_CLOCK        11
-#define PID_KCD          12
-#define PID_CRT          13
-#define PID_TIMER_IPROC  14
-#define PID_UART_IPROC   15
-
-/* Message Types */
-#define DEFAULT 0
-#define KCD_REG 1
-#define COUNT_REPORT 2
-#define WAKEUP10 3
-#define CLOCK 4
-
-#define NUM_MEM_BLOCKS 40
-
 /* ----- Types ----- */
 typedef unsigned int U32;
 
@@ -56,8 +24,30 @@ typedef struct proc_init
 	int m_priority;         /* initial priority, not used in this example. */ 
 	int m_stack_size;       /* size of stack in words */
 	void (*mpf_start_pc) ();/* entry point of the process */    
+	int m_quantum;          /* round-robin time slice in ms, 0 never time slices */
+	int m_mem_quota;        /* most memory blocks it may hold, 0 for no limit */
+	int m_mem_reserve;      /* 128 byte blocks kept free for it alone */
 } PROC_INIT;
 
+/* per process CPU accounting, times in us */
+typedef struct proc_stats
+{
+	U32 run_us;             /* time spent running */
+	U32 switches_vol;       /* switched out by blocking or release_processor */
+	U32 switches_invol;     /* preempted or time sliced */
+	U32 mem_us;             /* time blocked on a memory block */
+	U32 recv_us;            /* time blocked in receive_message or send_and_receive */
+	U32 sent;               /* messages sent */
+	U32 received;           /* messages received */
+	int state;              /* current PROC_STATE_E, filled in by get_process_stats */
+	U32 mem_used;           /* memory blocks it requested and are not released yet */
+	U32 mem_used_max;       /* high-water mark of mem_used */
+	U32 quota_hits;         /* requests that found it at its quota */
+	U32 misses;             /* periods finished after their deadline, see wait_next_period */
+	U32 lateness_max;       /* worst lateness in ms */
+	int priority;           /* current priority, filled in by get_process_stats */
+} PROC_STATS;
+
 /* message buffer */
 typedef struct msgbuf
 {
@@ -92,11 +82,30 @@ extern void *k_request_memory_block(void);
 #define request_memory_block() _request_memory_block((U32)k_request_memory_block)
 extern void *_request_memory_block(U32 p_func) __SVC_0;
 
+/* a block of at least size bytes, from the smallest slab class it fits in */
+extern void *k_request_memory(int size);
+#define request_memory(size) _request_memory((U32)k_request_memory, size)
+extern void *_request_memory(U32 p_func, int size) __SVC_0;
+
+/* mtext bytes the block p_msg holds, blocks from request_memory can hold more than MTEXT_SIZE */
+extern int k_mtext_size(void *p_msg);
+#define mtext_size(p_msg) _mtext_size((U32)k_mtext_size, p_msg)
+extern int _mtext_size(U32 p_func, void *p_msg) __SVC_0;
+
+/* blocks in the pool that serves requests of size bytes, sized from free RAM at boot */
+extern int k_pool_capacity(int size);
+#define pool_capacity(size) _pool_capacity((U32)k_pool_capacity, size)
+extern int _pool_capacity(U32 p_func, int size) __SVC_0;
+
 
 extern int k_release_memory_block(void *);
 #define release_memory_block(p_mem_blk) _release_memory_block((U32)k_release_memory_block, p_mem_blk)
 extern int _release_memory_block(U32 p_func, void *p_mem_blk) __SVC_0;
 
+extern int k_share_memory_block(void *p_mem_blk, int n);
+#define share_memory_block(p_mem_blk, n) _share_memory_block((U32)k_share_memory_block, p_mem_blk, n)
+extern int _share_memory_block(U32 p_func, void *p_mem_blk, int n) __SVC_0;
+
 /* IPC Management */
 extern int k_send_message(int pid, void *p_msg);
 #define send_message(pid, p_msg) _send_message((U32)k_send_message, pid, p_msg)
@@ -106,6 +115,40 @@ extern void *k_receive_message(int *p_pid);
 #define receive_message(p_pid) _receive_message((U32)k_receive_message, p_pid)
 extern void *_receive_message(U32 p_func, void *p_pid) __SVC_0;
 
+/* Dynamic Processes */
+extern int k_create_process(void (*entry)(), int priority, int stack_size);
+#define create_process(entry, prio, stack_size) _create_process((U32)k_create_process, entry, prio, stack_size)
+extern int _create_process(U32 p_func, void (*entry)(), int priority, int stack_size) __SVC_0;
+
+extern int k_exit_process(void);
+#define exit_process() _exit_process((U32)k_exit_process)
+extern int _exit_process(U32 p_func) __SVC_0;
+
+/* Periodic Processes */
+extern int k_set_period(int period, int deadline, int wcet, int edf);
+#define set_period(period, deadline, wcet, edf) _set_period((U32)k_set_period, period, deadline, wcet, edf)
+extern int _set_period(U32 p_func, int period, int deadline, int wcet, int edf) __SVC_0;
+
+extern int k_wait_next_period(void);
+#define wait_next_period() _wait_next_period((U32)k_wait_next_period)
+extern int _wait_next_period(U32 p_func) __SVC_0;
+
+extern int k_get_process_stats(int pid, PROC_STATS *p_stats);
+#define get_process_stats(pid, p_stats) _get_process_stats((U32)k_get_process_stats, pid, p_stats)
+extern int _get_process_stats(U32 p_func, int pid, void *p_stats) __SVC_0;
+
+extern void *k_receive_message_nb(int *p_pid);
+#define receive_message_nb(p_pid) _receive_message_nb((U32)k_receive_message_nb, p_pid)
+extern void *_receive_message_nb(U32 p_func, void *p_pid) __SVC_0;
+
+extern void *k_send_and_receive(int pid, void *p_msg);
+#define send_and_receive(pid, p_msg) _send_and_receive((U32)k_send_and_receive, pid, p_msg)
+extern void *_send_and_receive(U32 p_func, int pid, void *p_msg) __SVC_0;
+
+extern int k_reply(int pid, void *p_msg);
+#define reply(pid, p_msg) _reply((U32)k_reply, pid, p_msg)
+extern int _reply(U32 p_func, int pid, void *p_msg) __SVC_0;
+
 /* Timing Service */
 extern int k_delayed_send(int pid, void *p_msg, int delay);
 #define delayed_send(pid, p_msg, delay) _delayed_send((U32)k_delayed_send, pid, p_msg, delay)
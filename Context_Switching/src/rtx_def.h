@@ -0,0 +1,54 @@
+/**
+ * @file:   rtx_def.h
+ * @brief:  definitions the user API (rtx.h) and the kernel (k_rtx.h) share,
+ *          kept here once so the two cannot drift apart
+ */
+
+#ifndef RTX_DEF_H_
+#define RTX_DEF_H_
+
+#define RTX_ERR -1
+#define NULL 0
+#define NUM_TEST_PROCS 6
+#define NUM_KERNEL_PROCS 2
+#define NUM_SYSTEM_PROCS 7
+#define NUM_PROCS 16		//everything above(15) + null proc(1)
+#define MAX_DYN_PROCS 8		//processes made by create_process, pids NUM_PROCS and up
+#define MAX_PROCS (NUM_PROCS + MAX_DYN_PROCS)
+
+/* Process IDs */
+#define PID_NULL 0
+#define PID_P1   1
+#define PID_P2   2
+#define PID_P3   3
+#define PID_P4   4
+#define PID_P5   5
+#define PID_P6   6
+#define PID_A    7
+#define PID_B    8
+#define PID_C    9
+#define PID_SET_PRIO     10
+#define PID_CLOCK        11
+#define PID_KCD          12
+#define PID_CRT          13
+#define PID_TIMER_IPROC  14
+#define PID_UART_IPROC   15
+
+/* Message Types */
+#define DEFAULT 0
+#define KCD_REG 1
+#define COUNT_REPORT 2
+#define WAKEUP10 3
+#define CLOCK 4
+#define BENCH_SEND 5
+#define BENCH_CALL 6
+#define TOP_TICK 7
+#define EDF_START 8
+#define EDF_DONE 9
+
+#define NUM_MEM_BLOCKS 40 /* fewest 128 byte blocks, memory_init gives the pool all free RAM and warns below this */
+#define MTEXT_SIZE 124  /* mtext bytes a memory block really holds */
+
+#define RR_QUANTUM 20   /* default round-robin time slice in ms */
+
+#endif /* ! RTX_DEF_H_ */
@@ -3,11 +3,12 @@
 #include "system_proc.h"
 #include <LPC17xx.h>
 #include <system_LPC17xx.h>
-#ifdef DEBUG_0
+#include <string.h>
+#include "timer.h"
+#include "k_log.h"
+#include "k_trace.h"
 #include "printf.h"
 
-#endif /* DEBUG_0 */
-
 PROC_INIT g_system_procs[NUM_SYSTEM_PROCS];
 
 
@@ -16,11 +17,15 @@ void set_system_procs() {
 	for( i = 0; i < NUM_SYSTEM_PROCS; i++ ) {
 		g_system_procs[i].m_priority=0;
 		g_system_procs[i].m_stack_size=0x100;
+		g_system_procs[i].m_quantum=RR_QUANTUM;
+		g_system_procs[i].m_mem_quota=0;
+		g_system_procs[i].m_mem_reserve=0;
 	}
 	
 	g_system_procs[0].mpf_start_pc = &a_process;
 	g_system_procs[0].m_pid=PID_A;
 	g_system_procs[0].m_priority = LOWEST;
+	g_system_procs[0].m_mem_quota = 12;	//the stress test can not drain the pool
 	
 	g_system_procs[1].mpf_start_pc = &b_process;
 	g_system_procs[1].m_pid=PID_B;
@@ -32,12 +37,16 @@ void set_system_procs() {
 	
 	g_system_procs[3].mpf_start_pc = &set_priority_process;
 	g_system_procs[3].m_pid=PID_SET_PRIO;
+	g_system_procs[3].m_mem_reserve = 1;	//error reply
 	
 	g_system_procs[4].mpf_start_pc = &clock_process;
 	g_system_procs[4].m_pid=PID_CLOCK;
+	g_system_procs[4].m_mem_reserve = 1;
 	
 	g_system_procs[5].mpf_start_pc = &kcd_process;
 	g_system_procs[5].m_pid=PID_KCD;
+	g_system_procs[5].m_stack_size=0x300;	//dispatch, %P formatting
+	g_system_procs[5].m_mem_reserve = 4;	//input lines and replies stay responsive under load
 	
 	g_system_procs[6].mpf_start_pc = &crt_process;
 	g_system_procs[6].m_pid=PID_CRT;
@@ -45,91 +54,377 @@ void set_system_procs() {
 
 void null_process(void) {
 	while(1) {
+		//nothing else to run, encode pending log records for the UART
+		log_drain();
+#ifdef TICKLESS
+		//sleep until the next deadline or UART input, an interrupt that readies
+		//a process preempts us as soon as irqs are enabled again
+		__disable_irq();
+		timer_idle_enter();
+		__WFI();
+		timer_idle_exit();
+		__enable_irq();
+#else
 			release_processor();
+#endif /* TICKLESS */
 	}
 }
 
+void process_return(void) {
+	exit_process();
+}
+
 //system processes 
-void kcd_process(void){
-	char* buffer = (char*)request_memory_block();
-	char commands[NUM_PROCS];
-	int index = 0;
+KCD_CMD g_kcd_cmds[KCD_MAX_CMDS];
+int g_kcd_hash[KCD_HASH_SIZE];
+int g_kcd_count = 0;
+volatile unsigned int g_kcd_exited = 0;
+
+int kcd_hash(char *name, int len) {
+	unsigned int h = 2166136261u;
+	int i;
+	for (i = 0; i < len; i++) {
+		h = (h ^ (unsigned char)name[i]) * 16777619u;
+	}
+	return h & (KCD_HASH_SIZE - 1);
+}
+
+//length of the command name at str, up to a blank or the end of the line
+int kcd_name_len(char *str) {
+	int len = 0;
+	while (len < KCD_NAME_MAX && str[len] != '\0' && str[len] != ' ' && str[len] != '\r') {
+		len++;
+	}
+	return len;
+}
+
+int kcd_register(char *name, int len, int pid) {
+	int h = kcd_hash(name, len);
+	int i;
 	
-	int k;
-	for(k = 0; k<NUM_PROCS; k++)
-		commands[k] = '\0';
+	for (i = g_kcd_hash[h]; i != -1; i = g_kcd_cmds[i].next) {
+		if (g_kcd_cmds[i].pid == pid && g_kcd_cmds[i].len == len && strncmp(g_kcd_cmds[i].name, name, len) == 0) {
+			return 0;
+		}
+	}
+	if (len == 0 || g_kcd_count == KCD_MAX_CMDS) {
+		return RTX_ERR;
+	}
 	
-	while (1) {
-		int sender;
-		MSG_BUF* msg = (MSG_BUF*) receive_message(&sender);
+	i = g_kcd_count++;
+	strncpy(g_kcd_cmds[i].name, name, len);
+	g_kcd_cmds[i].len = len;
+	g_kcd_cmds[i].pid = pid;
+	g_kcd_cmds[i].next = g_kcd_hash[h];
+	g_kcd_hash[h] = i;
+	return 0;
+}
+
+//drop the commands of processes that exited, a new process may get their pid.
+//The registry is packed and its chains rebuilt, in the same order
+void kcd_forget_exited(void) {
+	unsigned int exited;
+	int n = 0;
+	int h;
+	int i;
+	
+	__disable_irq();
+	exited = g_kcd_exited;
+	g_kcd_exited = 0;
+	__enable_irq();
+	if (exited == 0) {
+		return;
+	}
+	
+	for (i = 0; i < g_kcd_count; i++) {
+		if (!(exited & (1 << g_kcd_cmds[i].pid))) {
+			g_kcd_cmds[n++] = g_kcd_cmds[i];
+		}
+	}
+	g_kcd_count = n;
+	for (h = 0; h < KCD_HASH_SIZE; h++) {
+		g_kcd_hash[h] = -1;
+	}
+	for (i = 0; i < g_kcd_count; i++) {
+		h = kcd_hash(g_kcd_cmds[i].name, g_kcd_cmds[i].len);
+		g_kcd_cmds[i].next = g_kcd_hash[h];
+		g_kcd_hash[h] = i;
+	}
+}
+
+//%P state, all in KCD
+int g_top_on = 0;
+int g_top_armed = 0;        //a TOP_TICK is on its way
+U32 g_top_last[MAX_PROCS];  //run_us at the last refresh
+U32 g_top_delta[MAX_PROCS];
+
+//in PROC_STATE_E order, the blocked states by what they wait for
+char *g_top_states[] = {"NEW", "RDY", "RUN", "MEM", "RECV", "REPLY", "EXIT", "WAIT"};
+#define TOP_EXITED 6
+#define TOP_NUM_STATES 8
+
+//add a line to the %P block being filled, the block goes to CRT first if the line does not fit
+void kcd_top_line(MSG_BUF** p_msg, int* p_len, char* line) {
+	int len = strlen(line);
+	
+	if (*p_msg != NULL && *p_len + len >= TOP_TEXT_SIZE) {
+		send_message(PID_CRT, *p_msg);
+		*p_msg = NULL;
+	}
+	if (*p_msg == NULL) {
+		*p_msg = (MSG_BUF*) request_memory(TOP_BLOCK_SIZE);
+		(*p_msg)->mtype = DEFAULT;
+		*p_len = 0;
+	}
+	strcpy((*p_msg)->mtext + *p_len, line);
+	*p_len += len;
+}
+
+//print one line per process through CRT, cpu% is since the last refresh
+void kcd_top(void) {
+	PROC_STATS st;
+	MSG_BUF* msg = NULL;
+	char line[TOP_LINE_SIZE];
+	int len = 0;
+	U32 total = 0;
+	int pid;
+	
+	for (pid = 0; pid < MAX_PROCS; pid++) {
+		get_process_stats(pid, &st);
+		g_top_delta[pid] = st.run_us - g_top_last[pid];
+		g_top_last[pid] = st.run_us;
+		total += g_top_delta[pid];
+	}
+	
+	kcd_top_line(&msg, &len, "\r\npid pri state  cpu%   run ms   vol   inv  mem ms recv ms  sent  recv miss  blk\r\n");
+	
+	for (pid = 0; pid < MAX_PROCS; pid++) {
+		U32 pct10 = total >= 1000 ? g_top_delta[pid] / (total / 1000) : 0;
 		
-		if (msg->mtype == KCD_REG)  {					//registers the command
-			char* msg_str = msg->mtext;
-			if (msg_str[0] == '%' && msg_str[1] != '\0') {
-				commands[sender] = msg_str[1];
-			}						
-			release_memory_block(msg);
-		} else if (msg->mtype == DEFAULT) {		//single character msg
-			char* msg_str = msg->mtext;	
-			
-			if (index >= 126) {
-				index = 0;
-				buffer[0] = '\0';
+		get_process_stats(pid, &st);
+		if (st.state == TOP_EXITED) {
+			continue;	//free pcb
+		}
+		sprintf(line, "%3d %3d %5s %3d.%d %8u %5u %5u %7u %7u %5u %5u %4u %4u\r\n", 
+			pid, st.priority, (st.state >= 0 && st.state < TOP_NUM_STATES) ? g_top_states[st.state] : "?", pct10 / 10, pct10 % 10, st.run_us / 1000, 
+			st.switches_vol, st.switches_invol, st.mem_us / 1000, st.recv_us / 1000, 
+			st.sent, st.received, st.misses, st.mem_used);
+		kcd_top_line(&msg, &len, line);
+	}
+	send_message(PID_CRT, msg);
+}
+
+//commands KCD handles itself, registered with its own pid
+void kcd_builtin(MSG_BUF* msg) {
+	if (strncmp(msg->mtext, "%DT", 3) == 0) {
+		trace_dump();
+	} else if (strncmp(msg->mtext, "%P", 2) == 0) {
+		//toggle the refreshing table
+		g_top_on = !g_top_on;
+		if (g_top_on) {
+			kcd_top();
+			if (!g_top_armed) {
+				MSG_BUF* tick = (MSG_BUF*) request_memory_block();
+				tick->mtype = TOP_TICK;
+				g_top_armed = 1;
+				delayed_send(PID_KCD, tick, TOP_PERIOD);
+			}
+		}
+	}
+}
+
+//hands the line to every process registered for its longest matching
+//command prefix, all of them share the one block
+void kcd_dispatch(MSG_BUF* msg) {
+	char* name = msg->mtext + 1;
+	int targets[MAX_PROCS];
+	int count = 0;
+	int len;
+	int i;
+	
+	if (msg->mtext[0] == '%') {
+		//"%WS 10:00:00" goes to %WS if registered, otherwise to %W
+		for (len = kcd_name_len(name); len > 0 && count == 0; len--) {
+			for (i = g_kcd_hash[kcd_hash(name, len)]; i != -1 && count < MAX_PROCS; i = g_kcd_cmds[i].next) {
+				if (g_kcd_cmds[i].len == len && strncmp(g_kcd_cmds[i].name, name, len) == 0) {
+					targets[count++] = g_kcd_cmds[i].pid;
+				}
 			}
+		}
+	}
+	
+	if (count == 0) {
+		release_memory_block(msg);
+		return;
+	}
+	if (count > 1 && share_memory_block(msg, count - 1) == RTX_ERR) {
+		count = 1;	//too many shared blocks out, only the first handler gets it
+	}
+	for (i = 0; i < count; i++) {
+		if (targets[i] == PID_KCD) {
+			kcd_builtin(msg);
+			release_memory_block(msg);
+		} else if (send_message(targets[i], msg) == RTX_ERR) {
+			release_memory_block(msg);	//the handler exited
+		}
+	}
+}
 
-			if(msg->mtext[0] == '\r') {
-				msg->mtext[1] = '\n';
-				msg->mtext[2] = '\0';
+//line being edited, see kcd_read_input
+char g_kcd_line[UART_LINE_MAX];
+int g_kcd_line_len = 0;
+
+//queue str on the echo ring, the caller kicks the transmitter
+void kcd_echo(char *str) {
+	while (*str != '\0' && g_echo_head - g_echo_tail < UART_ECHO_SIZE) {
+		g_echo[g_echo_head & (UART_ECHO_SIZE - 1)] = *str++;
+		g_echo_head++;
+	}
+}
+
+//line discipline: drains the UART receive ring, echoes and edits the
+//current line and dispatches it when it is complete
+void kcd_read_input(void) {
+	LPC_UART_TypeDef *pUart = (LPC_UART_TypeDef *) LPC_UART0;
+	
+	while (g_uart_rx_tail != g_uart_rx_head) {
+		char c = g_uart_rx[g_uart_rx_tail & (UART_RX_SIZE - 1)];
+		g_uart_rx_tail++;
+		
+		if (c == '\b' || c == 0x7F) {
+			if (g_kcd_line_len > 0) {
+				g_kcd_line_len--;
+				kcd_echo("\b \b");
 			}
+		} else if (c == '\r') {
+			int i;
+			MSG_BUF* msg;
 			
-			send_message(PID_CRT, msg);
+			kcd_echo("\r\n");
+			pUart->IER = IER_THRE | IER_RLS | IER_RBR;
+			g_kcd_line[g_kcd_line_len++] = '\r';
 			
-			if((msg->mtext[0] == '\b' || msg->mtext[0] == 0x7F) && index != 0) {
-				buffer[index] = '\0';
-				index--;
-			} else if ((msg->mtext[0] == '\b' || msg->mtext[0] == 0x7F) && index == 0) {
-				buffer[index] = '\0';
-			} else {
-				buffer[index] = (msg->mtext)[0];
-				buffer[index + 1] = '\0';
-				index++;
+			msg = (MSG_BUF*) request_memory_block();
+			for (i = 0; i < g_kcd_line_len; i++) {
+				(msg->mtext)[i] = g_kcd_line[i];
 			}
-				
+			(msg->mtext)[i] = '\0';
+			msg->mtype = DEFAULT;
+			g_kcd_line_len = 0;
+			kcd_dispatch(msg);
+		} else if (g_kcd_line_len < UART_LINE_MAX - 1) {	// room for the '\r'
+			char echo[2];
 			
-			if (msg_str[0] == '\r') {					// if is new line, check if buffer is a valid command
-				int i;				
-				if (buffer[0] == '%' && buffer[1] != '\0') {
-					for (i = 0; i < NUM_PROCS; i++) {
-						if (buffer[1] == commands[i]) {				//if is registered command				
-							int j;
-							//printf("commands[i]: %c buffer[1]: %c
-							MSG_BUF* msg = (MSG_BUF*) request_memory_block();
-							
-							for(j = 0; j< 127 && buffer[j]!='\0'; j++) {								//strcpy
-								(msg->mtext)[j] = buffer[j];
-									//printf("%d",msg->mtext);						
-							}															
-							(msg->mtext)[j] = '\0';	
-							
-							msg->mtype = DEFAULT;
-							send_message(i, msg);
-						}
-					}
-				}
-				index = 0;
-				buffer[0] = '\0';
-			}								
-		}		
-		//release_processor();
+			g_kcd_line[g_kcd_line_len++] = c;
+			echo[0] = c;
+			echo[1] = '\0';
+			kcd_echo(echo);
+		}
+	}
+	pUart->IER = IER_THRE | IER_RLS | IER_RBR;
+}
+
+void kcd_process(void){
+	int k;
+	for(k = 0; k < KCD_HASH_SIZE; k++)
+		g_kcd_hash[k] = -1;
+	kcd_register("DT", 2, PID_KCD);		//dump the scheduling trace
+	kcd_register("P", 1, PID_KCD);		//process table
+	
+	while (1) {
+		int sender;
+		MSG_BUF* msg = (MSG_BUF*) receive_message(&sender);
+		
+		kcd_forget_exited();
+		if (msg == NULL) {							//notified by the UART i-process
+#ifdef _DEBUG_HOTKEYS
+			hotkey_dump();
+#endif /* _DEBUG_HOTKEYS */
+			kcd_read_input();
+		} else if (msg->mtype == KCD_REG)  {					//registers the command, "%name"
+			char* msg_str = msg->mtext;
+			if (msg_str[0] == '%') {
+				kcd_register(msg_str + 1, kcd_name_len(msg_str + 1), sender);
+			}						
+			release_memory_block(msg);
+		} else if (msg->mtype == DEFAULT) {		//command line sent by a process
+			kcd_dispatch(msg);
+		} else if (msg->mtype == TOP_TICK && g_top_on) {
+			kcd_top();
+			delayed_send(PID_KCD, msg, TOP_PERIOD);
+		} else if (msg->mtype == TOP_TICK) {
+			g_top_armed = 0;
+			release_memory_block(msg);
+		} else {
+			release_memory_block(msg);
+		}
 	}	
 }
 
+char g_crt_ring[CRT_RING_SIZE];
+volatile unsigned int g_crt_head = 0;
+volatile unsigned int g_crt_tail = 0;
+volatile unsigned int g_crt_fwd_sent = 0;
+volatile unsigned int g_crt_fwd_done = 0;
+unsigned int g_crt_kicks = 0;
+unsigned int g_crt_bytes = 0;
+unsigned int g_crt_batch_max = 0;
+unsigned int g_crt_ring_max = 0;
+
+//copies msg into the output ring, returns 0 if it does not fit
+int crt_queue(MSG_BUF* msg) {
+	unsigned int head = g_crt_head;
+	int size = mtext_size(msg);
+	int len = 0;
+	int i;
+	
+	while (len < size && msg->mtext[len] != '\0') {
+		len++;
+	}
+	
+	// keep output in order: the ring is only used once the UART
+	// i-process is done with every block forwarded to it
+	if (g_crt_fwd_sent != g_crt_fwd_done || head - g_crt_tail + len > CRT_RING_SIZE) {
+		return 0;
+	}
+	
+	for (i = 0; i < len; i++) {
+		g_crt_ring[(head + i) & CRT_RING_MASK] = msg->mtext[i];
+	}
+	g_crt_head = head + len;
+	g_crt_bytes += len;
+	if (g_crt_head - g_crt_tail > g_crt_ring_max) {
+		g_crt_ring_max = g_crt_head - g_crt_tail;
+	}
+	return 1;
+}
+
 void crt_process(void){ 
 	LPC_UART_TypeDef *pUart = (LPC_UART_TypeDef *) LPC_UART0;
 	while (1) {
 		int sender;
+		unsigned int batch = 0;
 		MSG_BUF* msg = (MSG_BUF*) receive_message(&sender);
-		send_message(PID_UART_IPROC, msg);
+		
+		// coalesce everything queued so far, then kick the transmitter once
+		while (msg != NULL) {
+			if (crt_queue(msg)) {
+				if (CLOCK != msg->mtype) {
+					release_memory_block(msg);
+				}
+			} else {
+				// ring is full, let the UART i-process send the block itself
+				g_crt_fwd_sent++;
+				send_message(PID_UART_IPROC, msg);
+			}
+			batch++;
+			msg = (MSG_BUF*) receive_message_nb(&sender);
+		}
+		
+		g_crt_kicks++;
+		if (batch > g_crt_batch_max) {
+			g_crt_batch_max = batch;
+		}
 		pUart->IER = IER_THRE | IER_RLS | IER_RBR;			
 	}
 }
@@ -168,7 +463,7 @@ void a_process(void) {
     
     while(1) {
         int sender;
-        p = (MSG_BUF*)request_memory_block();
+        p = (MSG_BUF*)request_memory(sizeof(MSG_BUF));
         p->mtype = COUNT_REPORT;
         p->mtext[0] = num;
         send_message(PID_B, p);
@@ -6,6 +6,48 @@
 
 void set_system_procs(void);
 
+/* KCD command registry: names hash into chains of registrations, a name can
+   be taken by several processes and a process can register several names */
+#define KCD_MAX_CMDS 48
+#define KCD_HASH_SIZE 32    /* power of 2 */
+#define KCD_NAME_MAX 8
+
+typedef struct kcd_cmd {
+	char name[KCD_NAME_MAX];
+	int len;
+	int pid;
+	int next;               /* next registration in the same chain, -1 at the end */
+} KCD_CMD;
+
+/* dumps of the debug hotkeys the UART i-process recorded, kernel_procs.c */
+void hotkey_dump(void);
+
+/* pids that exited since KCD last looked, set by exit_process. KCD drops
+   their commands before it handles its next message */
+extern volatile unsigned int g_kcd_exited;
+
+/* %P process table, refreshed every TOP_PERIOD ms while on. Its lines are
+   packed into TOP_BLOCK_SIZE blocks, 6 to a block, not one block each */
+#define TOP_PERIOD 1000
+#define TOP_BLOCK_SIZE 512
+#define TOP_TEXT_SIZE (TOP_BLOCK_SIZE - 4)  /* mtext bytes, after mtype */
+#define TOP_LINE_SIZE 96
+
+/* CRT output ring, filled by the CRT process and drained by the UART i-process.
+   Head and tail run freely, each is written by one side only */
+#define CRT_RING_SIZE 256
+#define CRT_RING_MASK (CRT_RING_SIZE - 1)
+
+extern char g_crt_ring[CRT_RING_SIZE];
+extern volatile unsigned int g_crt_head;
+extern volatile unsigned int g_crt_tail;
+extern volatile unsigned int g_crt_fwd_sent;  //blocks CRT forwarded because the ring was full
+extern volatile unsigned int g_crt_fwd_done;  //forwarded blocks the UART i-process finished with
+extern unsigned int g_crt_kicks;
+extern unsigned int g_crt_bytes;
+extern unsigned int g_crt_batch_max;
+extern unsigned int g_crt_ring_max;
+
 
 //NULL process
 void null_process(void);
@@ -20,4 +62,7 @@ void clock_process(void);
 void kcd_process(void);
 void crt_process(void);
 
+//where a created process goes when its entry function returns
+void process_return(void);
+
 #endif
@@ -10,11 +10,16 @@
 #include "timer.h"
 #include "printf.h"
 #include "kernel_procs.h"
+#include "k_process.h"
+#include "k_log.h"
+#include "k_trace.h"
 #define BIT(X) (1<<X)
 
 volatile uint32_t g_timer_count = 0; // increment every 1 ms
+volatile uint32_t g_timer_period = 1; // ms covered by the current MR0 match
 extern PCB* gp_current_process;
 extern PCB **gp_pcbs; 
+extern U32 g_slices_forced;
 /**
  * @brief: initialize timer. Only timer 0 is supported
  */
@@ -67,22 +72,25 @@ uint32_t timer_init(uint8_t n_timer)
 	/* Step 4.1: Prescale Register PR setting 
 	   CCLK = 100 MHZ, PCLK = CCLK/4 = 25 MHZ
 	   2*(12499 + 1)*(1/25) * 10^(-6) s = 10^(-3) s = 1 ms
-	   TC (Timer Counter) toggles b/w 0 and 1 every 12500 PCLKs
+	   TC (Timer Counter) counts up every 12500 PCLKs, two counts per ms
 	   see MR setting below 
 	*/
 	pTimer->PR = 12499;  
 
 	/* Step 4.2: MR setting, see section 21.6.7 on pg496 of LPC17xx_UM. */
-	pTimer->MR0 = 1;
+	pTimer->MR0 = 2;
 
 	/* Step 4.3: MCR setting, see table 429 on pg496 of LPC17xx_UM.
 	   Interrupt on MR0: when MR0 mathches the value in the TC, 
 	                     generate an interrupt.
-	   Reset on MR0: Reset TC if MR0 mathches it.
+	   TC is never reset, the IRQ handler moves MR0 two counts on instead.
+	   Tickless idle can then move the next match without losing the part
+	   of a ms that already elapsed.
 	*/
-	pTimer->MCR = BIT(0) | BIT(1);
+	pTimer->MCR = BIT(0);
 
 	g_timer_count = 0;
+	g_timer_period = 1;
 
 	/* Step 4.4: CSMSIS enable timer0 IRQ */
 	NVIC_EnableIRQ(TIMER0_IRQn);
@@ -93,6 +101,21 @@ uint32_t timer_init(uint8_t n_timer)
 	return 0;
 }
 
+/**
+ * @brief: make match the next MR0 match, counting the ms of matches TC passed
+ *         before MR0 was written (TC never resets, so they would be lost)
+ * PRE: interrupts disabled or in the TIMER0 IRQ, g_timer_period is 1
+ */
+void timer_set_match(uint32_t match)
+{
+	LPC_TIM0->MR0 = match;
+	while ((int)(LPC_TIM0->TC - match) >= 0 && !(LPC_TIM0->IR & BIT(0))) {
+		g_timer_count++;
+		match += 2;
+		LPC_TIM0->MR0 = match;
+	}
+}
+
 /**
  * @brief: use CMSIS ISR for TIMER0 IRQ Handler
  * NOTE: This example shows how to save/restore all registers rather than just
@@ -119,18 +142,129 @@ void c_TIMER0_IRQHandler(void)
 	/* ack inttrupt, see section  21.6.1 on pg 493 of LPC17XX_UM */
 	LPC_TIM0->IR = BIT(0);  
 	
-	g_timer_count++;
+	g_timer_count += g_timer_period;
+	// next match 1 ms on, this also ends an idle period
+	g_timer_period = 1;
+	timer_set_match(LPC_TIM0->MR0 + 2);
 	
 	old_proc = gp_current_process;
 	gp_current_process = gp_pcbs[PID_TIMER_IPROC];
+	TRACE(TRACE_IRQ_ENTER, PID_TIMER_IPROC, TIMER0_IRQn);
 	
 	timer_i_process();
+	k_period_tick();
 	
+	TRACE(TRACE_IRQ_EXIT, PID_TIMER_IPROC, TIMER0_IRQn);
 	gp_current_process = old_proc;
 	
-	k = peekQ();	
-	if (k != -1 && (gp_pcbs[k]->m_priority) < (gp_current_process->m_priority)) {
-		k_release_processor();
-	}	
+	if (!k_check_preemption() && gp_current_process != NULL && gp_current_process->m_quantum > 0 
+			&& !gp_current_process->m_edf && --(gp_current_process->m_slice_left) <= 0) {
+		// time slice used up, rotate to the tail of its priority if a peer is ready
+		gp_current_process->m_slice_left = gp_current_process->m_quantum;
+		k = peekQ();
+		if (k != -1 && (gp_pcbs[k]->m_priority) == (gp_current_process->m_priority)) {
+			g_slices_forced++;
+			LOG1(LOG_SLICE, gp_current_process->m_pid);
+			k_pend_switch();
+		}
+	}
 }
 
+/**
+ * @brief: stretch the next timer match up to the earliest delayed_send deadline or periodic release
+ * PRE: called from the null process with interrupts disabled
+ * NOTE: TC counts every 0.5 ms, so n ms is 2n counts on from the last match (see timer_init)
+ */
+void timer_idle_enter(void)
+{
+	uint32_t match;
+	int deadline;
+	int release;
+	int sleep;
+	
+	deadline = timer_next_deadline();
+	release = k_next_release();
+	if (release != -1 && (deadline == -1 || release - deadline < 0)) {
+		deadline = release;
+	}
+	if (deadline == -1) {
+		sleep = TICKLESS_MAX_SLEEP;
+	} else {
+		sleep = deadline - (int)g_timer_count;
+	}
+	
+	if (sleep <= 1) {
+		return;
+	} else if (sleep > TICKLESS_MAX_SLEEP) {
+		sleep = TICKLESS_MAX_SLEEP;
+	}
+
+	/* a 1 ms match that is already pending must be counted as 1 ms, WFI
+	   returns at once and the IRQ handler adds g_timer_period */
+	if (LPC_TIM0->IR & BIT(0)) {
+		return;
+	}
+
+	/* the next match is 1 ms after the last one, move it sleep - 1 ms further */
+	match = LPC_TIM0->MR0;
+	g_timer_period = sleep;
+	LPC_TIM0->MR0 = match + 2 * (sleep - 1);
+
+	/* the tick may have matched while MR0 was being written */
+	if (LPC_TIM0->IR & BIT(0)) {
+		LPC_TIM0->MR0 = match;
+		g_timer_period = 1;
+	}
+}
+
+/**
+ * @brief: leave an idle period before its match, e.g. woken by the UART
+ * PRE: interrupts disabled
+ */
+void timer_idle_exit(void)
+{
+	uint32_t tc = LPC_TIM0->TC;
+	uint32_t last;
+	uint32_t ms;
+	
+	/* nothing to do while ticking, and a pending match is left to the IRQ handler.
+	   TC is read first, so without a match pending it is short of MR0 */
+	if (g_timer_period == 1 || (LPC_TIM0->IR & BIT(0))) {
+		return;
+	}
+	
+	/* count the whole ms since the last match and go back to the 1 ms tick
+	   on the same phase, the part of the current ms stays in TC and PC */
+	last = LPC_TIM0->MR0 - 2 * g_timer_period;
+	ms = (tc - last) / 2;
+	g_timer_count += ms;
+	g_timer_period = 1;
+	timer_set_match(last + 2 * (ms + 1));
+}
+
+/**
+ * @brief: PCLK ticks since the last match g_timer_count accounts for
+ * NOTE: TC and PC keep counting past 1 ms in a stretched idle period,
+ *       g_timer_count only catches up at its end
+ */
+uint32_t timer_ticks(void)
+{
+	uint32_t tc;
+	uint32_t pc;
+	
+	//PC wraps into TC, read them again if TC moved in between
+	do {
+		tc = LPC_TIM0->TC;
+		pc = LPC_TIM0->PC;
+	} while (tc != LPC_TIM0->TC);
+	
+	return (tc - (LPC_TIM0->MR0 - 2 * g_timer_period)) * (LPC_TIM0->PR + 1) + pc;
+}
+
+/**
+ * @brief: us since timer_init, from g_timer_count and the TIMER0 counters
+ */
+uint32_t timer_now_us(void)
+{
+	return g_timer_count * 1000 + timer_ticks() / 25;
+}
@@ -8,4 +8,15 @@
 
 extern uint32_t timer_init ( uint8_t n_timer );  /* initialize timer n_timer */
 
+/* Tickless idle (define TICKLESS in the target options).
+   While the null process idles, TIMER0 is reprogrammed to fire at the
+   next delayed_send deadline instead of every 1 ms. */
+#define TICKLESS_MAX_SLEEP 1000   /* longest idle period in ms */
+
+extern uint32_t timer_now_us(void);  /* free running us timestamp, wraps after 71 minutes */
+extern uint32_t timer_ticks(void);   /* PCLK ticks since the last 1 ms (or idle period) match */
+
+extern void timer_idle_enter(void); /* stretch MR0 up to the next deadline */
+extern void timer_idle_exit(void);  /* early wake-up, catch up g_timer_count */
+
 #endif /* ! _TIMER_H_ */
@@ -55,6 +55,40 @@
 //#define UART_8N1  0x83
 						 
 
+/* RX FIFO trigger level: 4, 8 or 14 chars per RDA interrupt. Characters
+   left below the level are picked up by the character time-out (CTI). */
+#define UART_RX_TRIGGER 8
+
+#if UART_RX_TRIGGER == 14
+#define FCR_RX_TRIGGER (3 << 6)
+#elif UART_RX_TRIGGER == 8
+#define FCR_RX_TRIGGER (2 << 6)
+#elif UART_RX_TRIGGER == 4
+#define FCR_RX_TRIGGER (1 << 6)
+#else
+#define FCR_RX_TRIGGER 0
+#endif
+
+/* longest input line incl. the '\r', must fit in a memory block's mtext */
+#define UART_LINE_MAX 120
+
+/* single producer, single consumer byte rings between the UART i-process and KCD.
+   head is only written by the producer, tail only by the consumer.
+   RX: filled by the i-process, drained by KCD after k_notify.
+   Echo: filled by KCD, drained by the THRE interrupt */
+#define UART_RX_SIZE 256    /* power of 2 */
+#define UART_ECHO_SIZE 64   /* power of 2 */
+
+extern uint8_t g_uart_rx[UART_RX_SIZE];
+extern volatile uint32_t g_uart_rx_head;
+extern volatile uint32_t g_uart_rx_tail;
+extern uint8_t g_echo[UART_ECHO_SIZE];
+extern volatile uint32_t g_echo_head;
+extern volatile uint32_t g_echo_tail;
+
+/* TX FIFO depth, bytes written per THRE interrupt */
+#define UART_TX_FIFO_SIZE 16
+
 #define uart0_irq_init() uart_irq_init(0)
 #define uart1_irq_init() uart_irq_init(1)       
      
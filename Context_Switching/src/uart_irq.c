@@ -14,10 +14,20 @@
 
 #include "system_proc.h"
 #include "k_rtx.h"
+#include "k_process.h"
+#include "k_trace.h"
 
 extern PCB* gp_current_process;
 extern PCB **gp_pcbs; 
 
+/* byte rings shared with KCD, see uart.h */
+uint8_t g_uart_rx[UART_RX_SIZE];
+volatile uint32_t g_uart_rx_head = 0;
+volatile uint32_t g_uart_rx_tail = 0;
+uint8_t g_echo[UART_ECHO_SIZE];
+volatile uint32_t g_echo_head = 0;
+volatile uint32_t g_echo_tail = 0;
+
 /**
  * @brief: initialize the n_uart
  * NOTES: It only supports UART0. It can be easily extended to support UART1 IRQ.
@@ -112,10 +122,10 @@ int uart_irq_init(int n_uart) {
 	       see table 278 on pg305 in LPC17xx_UM
 	-----------------------------------------------------
         enable Rx and Tx FIFOs, clear Rx and Tx FIFOs
-	Trigger level 0 (1 char per interrupt)
+	Trigger level UART_RX_TRIGGER chars per interrupt, see uart.h
 	*/
 	
-	pUart->FCR = 0x07;
+	pUart->FCR = 0x07 | FCR_RX_TRIGGER;
 
 	/* Step 5 was done between step 2 and step 4 a few lines above */
 
@@ -174,20 +184,18 @@ __asm void UART0_IRQHandler(void)
 void c_UART0_IRQHandler(void)
 {
 	void* old_proc;	
-	int k;
 	old_proc = gp_current_process;
 	
 	
 	gp_current_process = gp_pcbs[PID_UART_IPROC];
+	TRACE(TRACE_IRQ_ENTER, PID_UART_IPROC, UART0_IRQn);
 	
 	atomic_on();
 	uart_i_process();
 	atomic_off();
 	
+	TRACE(TRACE_IRQ_EXIT, PID_UART_IPROC, UART0_IRQn);
 	gp_current_process = old_proc;
 	
-	k = peekQ();	
-	if (k != -1 && (gp_pcbs[k]->m_priority) < (gp_current_process->m_priority)) {
-		k_release_processor();
-	}	
+	k_check_preemption();
 }
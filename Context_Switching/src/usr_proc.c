@@ -28,6 +28,24 @@ char GROUP_PREFIX[] = "G016_test: ";
 int LAST_PROC = 0;
 void *stress_requests[121] = {0};
 
+#define IPC_BENCH_ROUNDS 1000
+extern volatile uint32_t g_timer_count;
+
+#define EDF_RUN_MS 700 /* two hyperperiods of the task set below */
+
+/* Periodic task set with U = 20/50 + 35/70 = 0.9, over the rate monotonic bound
+	 for two tasks: the 70 ms task misses under fixed priorities but not under EDF */
+typedef struct edf_task {
+	int period;             /* ms, deadline is the end of the period */
+	int wcet;               /* ms of cpu burnt per period */
+	int priority;           /* rate monotonic priority for the fixed priority run */
+	int misses;             /* results of the last run */
+	int lateness_max;
+} EDF_TASK;
+
+EDF_TASK g_edf_tasks[2] = {{50, 20, HIGH, 0, 0}, {70, 35, MEDIUM, 0, 0}};
+int g_edf_mode = 0;
+
 
 void set_test_procs() {	
 	int i;		
@@ -35,6 +53,9 @@ void set_test_procs() {
 		g_test_procs[i].m_pid=(U32)(i+1);
 		g_test_procs[i].m_priority=LOWEST;
 		g_test_procs[i].m_stack_size=0x100;
+		g_test_procs[i].m_quantum=RR_QUANTUM;
+		g_test_procs[i].m_mem_quota=0;
+		g_test_procs[i].m_mem_reserve=0;
 	}
 	
 	g_test_procs[0].m_priority=MEDIUM;
@@ -105,6 +126,7 @@ void proc1(void)
 
 /* Test 1: Send message from proc2 to proc1 
 	 Test 3: gets message from proc1
+	 Afterwards echoes messages back for the IPC benchmark in proc6
 */
 void proc2(void)
 {	
@@ -127,7 +149,13 @@ void proc2(void)
 	release_memory_block(mem);	
 	
 	while(1) {
-		release_processor();
+		mem = receive_message(&sender);
+		msg = (MSG_BUF*)mem;
+		if (BENCH_CALL == msg->mtype) {
+			reply(sender, mem);
+		} else {
+			send_message(sender, mem);
+		}
 	}
 }
 
@@ -207,6 +235,125 @@ void proc5(void)
 }
 
 
+/* Round trips to proc2 (echo server) with send_message/receive_message
+	 and with send_and_receive/reply, both processes at the same priority */
+void ipc_benchmark(void)
+{
+	MSG_BUF *msg;
+	int sender;
+	int i;
+	uint32_t start;
+	
+	set_process_priority(PID_P2, LOW);
+	msg = (MSG_BUF*)request_memory_block();
+	
+	msg->mtype = BENCH_SEND;
+	start = g_timer_count;
+	for (i = 0; i < IPC_BENCH_ROUNDS; i++) {
+		send_message(PID_P2, msg);
+		msg = (MSG_BUF*)receive_message(&sender);
+	}
+	printf("%s%d send/receive round trips: %d ms\n\r", GROUP_PREFIX, IPC_BENCH_ROUNDS, g_timer_count - start);
+	
+	msg->mtype = BENCH_CALL;
+	start = g_timer_count;
+	for (i = 0; i < IPC_BENCH_ROUNDS; i++) {
+		msg = (MSG_BUF*)send_and_receive(PID_P2, msg);
+	}
+	printf("%s%d send_and_receive/reply round trips: %d ms\n\r", GROUP_PREFIX, IPC_BENCH_ROUNDS, g_timer_count - start);
+	
+	release_memory_block(msg);
+	set_process_priority(PID_P2, LOWEST);
+}
+
+/* One task of g_edf_tasks. The first EDF_START carries its pid and task index,
+	 the second starts the run so both tasks are released together */
+void edf_worker(void)
+{
+	MSG_BUF *msg;
+	MSG_BUF *go;
+	EDF_TASK *task;
+	PROC_STATS st;
+	int sender;
+	int pid;
+	U32 stop;
+	U32 start;
+	
+	msg = (MSG_BUF*)receive_message(&sender);
+	pid = msg->mtext[0];
+	task = &g_edf_tasks[(int)msg->mtext[1]];
+	
+	set_process_priority(pid, task->priority);
+	set_period(task->period, task->period, task->wcet, g_edf_mode);
+	stop = g_timer_count + EDF_RUN_MS;
+	go = (MSG_BUF*)receive_message(&sender);
+	release_memory_block(go);
+	
+	while ((int)(g_timer_count - stop) < 0) {
+		get_process_stats(pid, &st);
+		start = st.run_us;
+		while (st.run_us - start < (U32)task->wcet * 1000) {
+			get_process_stats(pid, &st);
+		}
+		wait_next_period();
+	}
+	
+	get_process_stats(pid, &st);
+	task->misses = st.misses;
+	task->lateness_max = st.lateness_max;
+	set_period(0, 0, 0, 0);
+	
+	msg->mtype = EDF_DONE;
+	send_message(sender, msg);
+}
+
+/* Run g_edf_tasks under rate monotonic fixed priorities, then under EDF */
+void edf_demo(void)
+{
+	MSG_BUF *msg;
+	int pid[2];
+	int sender;
+	int mode;
+	int late;
+	int misses;
+	int i;
+	
+	for (mode = 0; mode < 2; mode++) {
+		g_edf_mode = mode;
+		for (i = 0; i < 2; i++) {
+			pid[i] = create_process(&edf_worker, LOW, 0x200);
+			msg = (MSG_BUF*)request_memory_block();
+			msg->mtype = EDF_START;
+			msg->mtext[0] = pid[i];
+			msg->mtext[1] = i;
+			send_message(pid[i], msg);
+		}
+		//let both set their period, then start them
+		release_processor();
+		for (i = 0; i < 2; i++) {
+			msg = (MSG_BUF*)request_memory_block();
+			msg->mtype = EDF_START;
+			send_message(pid[i], msg);
+		}
+		
+		for (i = 0; i < 2; i++) {
+			msg = (MSG_BUF*)receive_message(&sender);
+			release_memory_block(msg);
+		}
+		
+		late = 0;
+		misses = 0;
+		for (i = 0; i < 2; i++) {
+			misses += g_edf_tasks[i].misses;
+			if (g_edf_tasks[i].lateness_max > late) {
+				late = g_edf_tasks[i].lateness_max;
+			}
+		}
+		printf("%s%s: %d deadline misses, worst lateness %d ms\n\r", GROUP_PREFIX, 
+			mode ? "EDF" : "fixed priority", misses, late);
+	}
+}
+
 void proc6(void)
 {
 	int i;
@@ -228,6 +375,10 @@ void proc6(void)
 	printf("%s%d/6 tests OK\n\r", GROUP_PREFIX, TOTAL_TESTS_PASSED);
 	printf("%s%d/6 tests FAIL\n\r", GROUP_PREFIX, 6 - TOTAL_TESTS_PASSED);
 	printf("%sEND\n\r", GROUP_PREFIX);
+	printf("%s%d memory blocks\n\r", GROUP_PREFIX, pool_capacity(MTEXT_SIZE));
+	
+	ipc_benchmark();
+	edf_demo();
 	
 	set_process_priority(PID_A, HIGH);
 	
@@ -250,6 +401,9 @@ void set_test_procs() {
 	for( i = 0; i < NUM_TEST_PROCS; i++ ) {
 		g_test_procs[i].m_pid=(U32)(i+1);
 		g_test_procs[i].m_stack_size=0x100;
+		g_test_procs[i].m_quantum=RR_QUANTUM;
+		g_test_procs[i].m_mem_quota=0;
+		g_test_procs[i].m_mem_reserve=0;
 	}
   
 	g_test_procs[0].mpf_start_pc = &proc1;
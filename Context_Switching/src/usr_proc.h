@@ -15,6 +15,9 @@ void proc3(void);
 void proc4(void);
 void proc5(void);
 void proc6(void);
+void ipc_benchmark(void);
+void edf_worker(void);
+void edf_demo(void);
 
 #endif /* USR_PROC_H_ */
 
@@ -0,0 +1,89 @@
+/**
+ * @file:   log_decode.c
+ * @brief:  host side decoder of the deferred log. Build it against the same
+ *          src/log_fmt.h as the firmware:
+ *              cc -I../src -o log_decode log_decode.c
+ *          and feed it a capture of the serial console:
+ *              ./log_decode < console.txt
+ *          "@L..." records are printed as text, everything else is passed through.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LOG_MAX_ARGS 3
+
+#define LOG_FMT(id, fmt) fmt,
+static const char *g_fmts[] = {
+#include "log_fmt.h"
+};
+#undef LOG_FMT
+
+#define NUM_FMTS (sizeof(g_fmts) / sizeof(g_fmts[0]))
+
+/* parse n hex digits, returns -1 if one of them is not hex */
+static int hex(const char *s, int n, unsigned int *value) {
+	*value = 0;
+	while (n-- > 0) {
+		char c = *s++;
+		*value <<= 4;
+		if (c >= '0' && c <= '9') {
+			*value |= c - '0';
+		} else if (c >= 'A' && c <= 'F') {
+			*value |= c - 'A' + 10;
+		} else {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* decodes the record at rec, returns 0 if it is not a valid one */
+static int decode(const char *rec) {
+	unsigned int id, nargs, time;
+	unsigned int args[LOG_MAX_ARGS] = {0, 0, 0};
+	unsigned int i;
+	
+	if (hex(rec, 2, &id) || hex(rec + 2, 1, &nargs) || hex(rec + 3, 8, &time)
+			|| nargs > LOG_MAX_ARGS || strlen(rec) < 11 + 8 * nargs) {
+		return 0;
+	}
+	for (i = 0; i < nargs; i++) {
+		if (hex(rec + 11 + 8 * i, 8, &args[i])) {
+			return 0;
+		}
+	}
+	
+	printf("[%6u.%03u] ", time / 1000, time % 1000);
+	if (id < NUM_FMTS) {
+		printf(g_fmts[id], args[0], args[1], args[2]);
+	} else {
+		printf("unknown log id %u: %x %x %x", id, args[0], args[1], args[2]);
+	}
+	printf("\n");
+	return 1;
+}
+
+int main(void) {
+	char line[512];
+	
+	while (fgets(line, sizeof(line), stdin) != NULL) {
+		char *rec = strstr(line, "@L");
+		
+		line[strcspn(line, "\r\n")] = '\0';
+		if (rec == NULL) {
+			printf("%s\n", line);
+			continue;
+		}
+		
+		// console output that shares the line with the record comes first
+		if (rec != line) {
+			printf("%.*s\n", (int)(rec - line), line);
+		}
+		if (!decode(rec + 2)) {
+			printf("%s\n", rec);
+		}
+	}
+	return 0;
+}
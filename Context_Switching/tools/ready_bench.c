@@ -0,0 +1,226 @@
+/**
+ * @file:   ready_bench.c
+ * @brief:  host side benchmark of the ready queue, old processQueue arrays
+ *          against the bitmap-indexed lists of k_process.c, for a growing
+ *          number of processes:
+ *              cc -O2 -o ready_bench ready_bench.c
+ *              ./ready_bench
+ *          Both queues are copies of the kernel code, the PCB only keeps the
+ *          fields they use. A round is what every context switch costs: the
+ *          switched out process is added back and the next one is popped, with
+ *          a peek like the one the IRQ handlers do. Both queues must hand out
+ *          the same pids, the benchmark stops if they do not.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#define NUM_PRIORITIES 5
+#define MAX_N 256
+#define ROUNDS 200000
+
+typedef struct pcb {
+	struct pcb *mp_next;
+	struct pcb *mp_prev;
+	int m_pid;
+	int m_priority;
+} PCB;
+
+static PCB g_pcbs[MAX_N];
+static int g_n;
+
+/* ----- old: one array of pids per priority, -1 marks the free tail ----- */
+static int processQueue[NUM_PRIORITIES][MAX_N];
+
+static void old_addQ(int pid, int priority) {
+	int i;
+	for (i = 0; i < g_n; i++) {
+		if (processQueue[priority][i] == -1) {
+			processQueue[priority][i] = pid;
+			break;
+		}
+	}
+}
+
+static int old_popQ(void) {
+	int i, k, pid;
+	for (i = 0; i < NUM_PRIORITIES; i++) {
+		if (processQueue[i][0] == -1) {
+			continue;
+		}
+		pid = processQueue[i][0];
+		for (k = 1; k < g_n; k++) {
+			processQueue[i][k-1] = processQueue[i][k];
+		}
+		processQueue[i][g_n-1] = -1;
+		return pid;
+	}
+	return -1;
+}
+
+static int old_peekQ(void) {
+	int i;
+	for (i = 0; i < NUM_PRIORITIES; i++) {
+		if (processQueue[i][0] != -1) {
+			return processQueue[i][0];
+		}
+	}
+	return -1;
+}
+
+/* ----- new: FIFO list per priority, bit (31 - priority) set while non-empty ----- */
+#define READY_BIT(prio) (0x80000000u >> (prio))
+
+static PCB *g_ready_head[NUM_PRIORITIES];
+static PCB *g_ready_tail[NUM_PRIORITIES];
+static uint32_t g_ready_bitmap;
+
+static void addQ(int pid, int priority) {
+	PCB *p_pcb = &g_pcbs[pid];
+
+	p_pcb->mp_next = NULL;
+	p_pcb->mp_prev = g_ready_tail[priority];
+	if (g_ready_tail[priority] != NULL) {
+		g_ready_tail[priority]->mp_next = p_pcb;
+	} else {
+		g_ready_head[priority] = p_pcb;
+	}
+	g_ready_tail[priority] = p_pcb;
+	g_ready_bitmap |= READY_BIT(priority);
+}
+
+static void removeQ(PCB *p_pcb, int priority) {
+	if (p_pcb->mp_prev != NULL) {
+		p_pcb->mp_prev->mp_next = p_pcb->mp_next;
+	} else {
+		g_ready_head[priority] = p_pcb->mp_next;
+	}
+	if (p_pcb->mp_next != NULL) {
+		p_pcb->mp_next->mp_prev = p_pcb->mp_prev;
+	} else {
+		g_ready_tail[priority] = p_pcb->mp_prev;
+	}
+	p_pcb->mp_next = NULL;
+	p_pcb->mp_prev = NULL;
+	if (g_ready_head[priority] == NULL) {
+		g_ready_bitmap &= ~READY_BIT(priority);
+	}
+}
+
+static int popQ(void) {
+	int priority;
+	PCB *p_pcb;
+
+	if (g_ready_bitmap == 0) {
+		return -1;
+	}
+	priority = __builtin_clz(g_ready_bitmap);
+	p_pcb = g_ready_head[priority];
+	removeQ(p_pcb, priority);
+	return p_pcb->m_pid;
+}
+
+static int peekQ(void) {
+	if (g_ready_bitmap == 0) {
+		return -1;
+	}
+	return g_ready_head[__builtin_clz(g_ready_bitmap)]->m_pid;
+}
+
+/* ----- benchmark ----- */
+static volatile int g_sink;
+
+static double now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* every process ready, spread over the user priorities, the null process in the last band */
+static void setup(int n) {
+	int i, j;
+
+	g_n = n;
+	g_ready_bitmap = 0;
+	for (i = 0; i < NUM_PRIORITIES; i++) {
+		g_ready_head[i] = g_ready_tail[i] = NULL;
+		for (j = 0; j < MAX_N; j++) {
+			processQueue[i][j] = -1;
+		}
+	}
+	for (i = 0; i < n; i++) {
+		g_pcbs[i].m_pid = i;
+		g_pcbs[i].m_priority = i == 0 ? NUM_PRIORITIES - 1 : i % (NUM_PRIORITIES - 1);
+		addQ(i, g_pcbs[i].m_priority);
+		old_addQ(i, g_pcbs[i].m_priority);
+	}
+}
+
+/* ns per round, running is the pid that holds the cpu at the start */
+static double run_old(int rounds) {
+	int running = old_popQ();
+	double t0 = now_ns();
+	int i;
+
+	for (i = 0; i < rounds; i++) {
+		old_addQ(running, g_pcbs[running].m_priority);
+		g_sink = old_peekQ();
+		running = old_popQ();
+	}
+	return (now_ns() - t0) / rounds;
+}
+
+static double run_new(int rounds) {
+	int running = popQ();
+	double t0 = now_ns();
+	int i;
+
+	for (i = 0; i < rounds; i++) {
+		addQ(running, g_pcbs[running].m_priority);
+		g_sink = peekQ();
+		running = popQ();
+	}
+	return (now_ns() - t0) / rounds;
+}
+
+/* both queues must schedule the same pids in the same order */
+static int same_schedule(int rounds) {
+	int a = old_popQ();
+	int b = popQ();
+	int i;
+
+	for (i = 0; i < rounds; i++) {
+		if (a != b) {
+			return 0;
+		}
+		old_addQ(a, g_pcbs[a].m_priority);
+		addQ(b, g_pcbs[b].m_priority);
+		a = old_popQ();
+		b = popQ();
+	}
+	return a == b;
+}
+
+int main(void) {
+	static const int counts[] = {8, 16, 24, 32, 64, 128, 256};
+	unsigned int i;
+
+	printf("%6s %14s %14s %8s\n", "procs", "old ns/round", "new ns/round", "speedup");
+	for (i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+		double t_old, t_new;
+
+		setup(counts[i]);
+		if (!same_schedule(10 * counts[i])) {
+			fprintf(stderr, "queues disagree with %d processes\n", counts[i]);
+			return 1;
+		}
+		setup(counts[i]);
+		t_old = run_old(ROUNDS);
+		setup(counts[i]);
+		t_new = run_new(ROUNDS);
+		printf("%6d %14.1f %14.1f %7.1fx\n", counts[i], t_old, t_new, t_old / t_new);
+	}
+	return 0;
+}
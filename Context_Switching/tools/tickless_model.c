@@ -0,0 +1,339 @@
+/**
+ * @file:   tickless_model.c
+ * @brief:  host side model of the TIMER0 code in src/timer.c, to measure
+ *          tickless idle without a board:
+ *              cc -O2 -o tickless_model tickless_model.c
+ *              ./tickless_model [seconds]
+ *          TIMER0 is simulated count by count (PR, PC, TC, MR0, IR), and every
+ *          register access lets a few PCLKs pass, so ticks land in the middle
+ *          of idle entry and exit like they do on the board. The timer
+ *          functions are copies of timer.c, keep them in sync. The kernel side
+ *          is reduced to what the timer sees: delayed_send deadlines, which are
+ *          sent again when they expire, and UART interrupts that wake the null
+ *          process.
+ *
+ *          For each load it prints timer interrupts and wakeups per second, the
+ *          mean time asleep per wakeup, how late deadlines are delivered (wake
+ *          latency, true time of the interrupt that delivers a message minus its
+ *          deadline) and how far g_timer_count plus timer_ticks() is off true
+ *          time when the null process wakes up. Current draw follows the share
+ *          of time awake. That share is given for an assumed cost per wakeup
+ *          and has to be measured on the board for real mA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#define BIT(X) (1<<X)
+#define PCLK_HZ 25000000
+#define TICKLESS_MAX_SLEEP 1000
+#define WHEEL0_SIZE 256
+#define WAKE_COST_US 10        /* assumed cpu time of one wakeup, ISR and kernel path */
+#define MAX_TIMERS 64
+
+/* ----- simulated TIMER0 ----- */
+typedef struct {
+	uint32_t IR, TCR, TC, PR, PC, MCR, MR0;
+} TIMER;
+
+static TIMER g_tim;
+static uint64_t g_pclk = 0;        /* true time in PCLKs */
+
+/* let n PCLKs pass, IR is set when TC counts onto MR0 */
+static void sim_run(uint64_t n) {
+	uint64_t total = g_tim.PC + n;
+	uint32_t counts = (uint32_t)(total / (g_tim.PR + 1));
+
+	g_pclk += n;
+	g_tim.PC = (uint32_t)(total % (g_tim.PR + 1));
+	if (counts > 0 && (uint32_t)(g_tim.MR0 - g_tim.TC - 1) < counts) {
+		g_tim.IR |= BIT(0);
+	}
+	g_tim.TC += counts;
+}
+
+/* PCLKs until the next match */
+static uint64_t sim_to_match(void) {
+	return (uint64_t)(uint32_t)(g_tim.MR0 - g_tim.TC - 1) * (g_tim.PR + 1) + (g_tim.PR + 1 - g_tim.PC);
+}
+
+/* a register access, a few PCLKs of code run before it */
+static TIMER *sim_tim(void) {
+	sim_run(rand() % 4);
+	return &g_tim;
+}
+#define LPC_TIM0 (sim_tim())
+
+static uint32_t now_true_us(void) {
+	return (uint32_t)(g_pclk / (PCLK_HZ / 1000000));
+}
+
+/* ----- kernel side: delayed messages as (deadline, period) pairs ----- */
+static uint32_t g_deadline[MAX_TIMERS];
+static int g_period[MAX_TIMERS];       /* 0 for a random delay of 1..3000 ms */
+static int g_num_timers;
+
+static double g_late_sum;
+static uint32_t g_late_max;
+static int g_early;
+static long g_delivered;
+
+volatile uint32_t g_timer_count = 0;
+volatile uint32_t g_timer_period = 1;
+
+static void timer_i_process(void) {
+	int i;
+
+	for (i = 0; i < g_num_timers; i++) {
+		if ((int)(g_timer_count - g_deadline[i]) >= 0) {
+			int32_t late = (int32_t)(now_true_us() - g_deadline[i] * 1000);
+
+			if (late < 0) {
+				g_early++;
+			} else {
+				g_late_sum += late;
+				if ((uint32_t)late > g_late_max) {
+					g_late_max = late;
+				}
+			}
+			g_delivered++;
+			g_deadline[i] = g_timer_count + (g_period[i] ? g_period[i] : 1 + rand() % 3000);
+		}
+	}
+}
+
+/* earliest deadline, capped at the end of level 0 of the wheel like kernel_procs.c */
+static int timer_next_deadline(void) {
+	uint32_t boundary = (g_timer_count + 1 + WHEEL0_SIZE) & ~(WHEEL0_SIZE - 1);
+	int best = -1;
+	int i;
+
+	for (i = 0; i < g_num_timers; i++) {
+		if (best == -1 || (int)(g_deadline[i] - (uint32_t)best) < 0) {
+			best = g_deadline[i];
+		}
+	}
+	if (best == -1 || (int)(boundary - (uint32_t)best) < 0) {
+		return best == -1 ? -1 : (int)boundary;
+	}
+	return best;
+}
+
+static int k_next_release(void) {
+	return -1;
+}
+
+/* ----- copied from src/timer.c ----- */
+void timer_set_match(uint32_t match)
+{
+	LPC_TIM0->MR0 = match;
+	while ((int)(LPC_TIM0->TC - match) >= 0 && !(LPC_TIM0->IR & BIT(0))) {
+		g_timer_count++;
+		match += 2;
+		LPC_TIM0->MR0 = match;
+	}
+}
+
+void c_TIMER0_IRQHandler(void)
+{
+	LPC_TIM0->IR = BIT(0);
+	g_tim.IR = 0;   /* model only, IR is write one to clear */
+
+	g_timer_count += g_timer_period;
+	g_timer_period = 1;
+	timer_set_match(LPC_TIM0->MR0 + 2);
+
+	timer_i_process();
+}
+
+void timer_idle_enter(void)
+{
+	uint32_t match;
+	int deadline;
+	int release;
+	int sleep;
+
+	deadline = timer_next_deadline();
+	release = k_next_release();
+	if (release != -1 && (deadline == -1 || release - deadline < 0)) {
+		deadline = release;
+	}
+	if (deadline == -1) {
+		sleep = TICKLESS_MAX_SLEEP;
+	} else {
+		sleep = deadline - (int)g_timer_count;
+	}
+
+	if (sleep <= 1) {
+		return;
+	} else if (sleep > TICKLESS_MAX_SLEEP) {
+		sleep = TICKLESS_MAX_SLEEP;
+	}
+
+	if (LPC_TIM0->IR & BIT(0)) {
+		return;
+	}
+
+	match = LPC_TIM0->MR0;
+	g_timer_period = sleep;
+	LPC_TIM0->MR0 = match + 2 * (sleep - 1);
+
+	if (LPC_TIM0->IR & BIT(0)) {
+		LPC_TIM0->MR0 = match;
+		g_timer_period = 1;
+	}
+}
+
+void timer_idle_exit(void)
+{
+	uint32_t tc = LPC_TIM0->TC;
+	uint32_t last;
+	uint32_t ms;
+
+	if (g_timer_period == 1 || (LPC_TIM0->IR & BIT(0))) {
+		return;
+	}
+
+	last = LPC_TIM0->MR0 - 2 * g_timer_period;
+	ms = (tc - last) / 2;
+	g_timer_count += ms;
+	g_timer_period = 1;
+	timer_set_match(last + 2 * (ms + 1));
+}
+
+uint32_t timer_ticks(void)
+{
+	uint32_t tc;
+	uint32_t pc;
+
+	do {
+		tc = LPC_TIM0->TC;
+		pc = LPC_TIM0->PC;
+	} while (tc != LPC_TIM0->TC);
+
+	return (tc - (LPC_TIM0->MR0 - 2 * g_timer_period)) * (LPC_TIM0->PR + 1) + pc;
+}
+
+uint32_t timer_now_us(void)
+{
+	return g_timer_count * 1000 + timer_ticks() / 25;
+}
+/* ----- end of the copy ----- */
+
+static void timer_init(void) {
+	g_tim.IR = 0;
+	g_tim.TC = 0;
+	g_tim.PC = 0;
+	g_tim.PR = 12499;
+	g_tim.MR0 = 2;
+	g_tim.MCR = BIT(0);
+	g_tim.TCR = 1;
+	g_pclk = 0;
+	g_timer_count = 0;
+	g_timer_period = 1;
+}
+
+/* random gap of an event stream with the given rate, in PCLKs */
+static uint64_t gap(double per_s) {
+	double u = (rand() + 1.0) / (RAND_MAX + 2.0);
+	double x = (u - 1) / (u + 1);
+	double term = x;
+	double ln = 0;
+	int k;
+
+	/* exponential gap -ln(u) / rate, ln from its atanh series so libm is not needed */
+	for (k = 1; k < 200; k += 2) {
+		ln += term / k;
+		term *= x * x;
+	}
+	return (uint64_t)(-2 * ln / per_s * PCLK_HZ) + 1;
+}
+
+/* seconds of idle time with the given load, tickless if it is set */
+static void run(const char *name, int tickless, int clocks, int randoms, double keys_per_s, int seconds) {
+	uint64_t end = (uint64_t)seconds * PCLK_HZ;
+	uint64_t next_key = keys_per_s > 0 ? gap(keys_per_s) : UINT64_MAX;
+	uint64_t asleep = 0;
+	long timer_irqs = 0;
+	long wakeups = 0;
+	long keys = 0;
+	int32_t err;
+	int32_t err_max = 0;
+	int i;
+
+	srand(1);
+	timer_init();
+	g_num_timers = 0;
+	g_late_sum = 0;
+	g_late_max = 0;
+	g_early = 0;
+	g_delivered = 0;
+	for (i = 0; i < clocks; i++) {   /* like clock_process, one delayed_send per second */
+		g_period[g_num_timers] = 1000;
+		g_deadline[g_num_timers++] = 1000;
+	}
+	for (i = 0; i < randoms; i++) {
+		g_period[g_num_timers] = 0;
+		g_deadline[g_num_timers++] = 1 + rand() % 3000;
+	}
+
+	while (g_pclk < end) {
+		/* null process: __disable_irq(), idle entry, WFI, idle exit, __enable_irq() */
+		if (tickless) {
+			timer_idle_enter();
+		}
+		if (!(g_tim.IR & BIT(0))) {
+			uint64_t t = sim_to_match();
+			if (next_key - g_pclk < t) {
+				t = next_key - g_pclk;
+			}
+			sim_run(t);
+			asleep += t;
+		}
+		wakeups++;
+		if (tickless) {
+			timer_idle_exit();
+		}
+		if (g_pclk >= next_key) {
+			/* UART interrupt, the woken process reads the time */
+			keys++;
+			err = (int32_t)(timer_now_us() - now_true_us());
+			if (err < 0) {
+				err = -err;
+			}
+			if (err > err_max) {
+				err_max = err;
+			}
+			next_key = g_pclk + gap(keys_per_s);
+		}
+		if (g_tim.IR & BIT(0)) {
+			sim_run(rand() % 50);   /* interrupt entry */
+			c_TIMER0_IRQHandler();
+			timer_irqs++;
+		}
+	}
+
+	err = (int32_t)(timer_now_us() - now_true_us());
+	printf("%-28s %8.1f %8.1f %8.2f %8.1f %8u %6d %8d %8d\n", name,
+		timer_irqs / (double)seconds, wakeups / (double)seconds,
+		asleep * 1000.0 / PCLK_HZ / (wakeups ? wakeups : 1),
+		g_delivered ? g_late_sum / g_delivered : 0.0, g_late_max, g_early,
+		err_max, err);
+	printf("%-28s awake %.3f%% at %d us per wakeup, %ld keys\n", "",
+		100.0 * (1.0 - (double)asleep / end) + 100.0 * wakeups * WAKE_COST_US / 1e6 / seconds,
+		WAKE_COST_US, keys);
+}
+
+int main(int argc, char **argv) {
+	int seconds = argc > 1 ? atoi(argv[1]) : 600;
+
+	printf("%-28s %8s %8s %8s %8s %8s %6s %8s %8s\n", "", "irq/s", "wake/s", "ms/wake",
+		"late us", "max us", "early", "|err| us", "end err");
+	run("1 ms tick, WFI", 0, 1, 0, 0, seconds);
+	run("tickless, clock", 1, 1, 0, 0, seconds);
+	run("tickless, clock + typing", 1, 1, 0, 5, seconds);
+	run("tickless, 50 random timers", 1, 1, 50, 0, seconds);
+	run("tickless, all of the above", 1, 1, 50, 5, seconds);
+	return 0;
+}
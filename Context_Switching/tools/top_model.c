@@ -0,0 +1,217 @@
+/**
+ * @file:   top_model.c
+ * @brief:  host side model of the %P table going out through CRT and the
+ *          UART, to check that a refresh never waits for a 512 byte block:
+ *              cc -O2 -I../src -o top_model top_model.c
+ *              ./top_model [seconds]
+ *          kcd_top and kcd_top_line are copies of src/system_proc.c, crt_queue
+ *          and the transmit side of the UART i-process are reduced to what
+ *          they do with the text: a block that fits the CRT ring is copied and
+ *          released at once, any other block is held by the UART i-process
+ *          until its last byte is in THR. The UART sends one byte per byte
+ *          time at 115200 baud, ring first. KCD refreshes every TOP_PERIOD ms
+ *          and runs in no time, unless request_memory finds the pool empty.
+ *
+ *          For a pool of SLAB_LARGE_COUNT blocks and for the old count of 2,
+ *          with the boot processes and with every pid in use, it prints the
+ *          refreshes that blocked KCD, how long it waited in total and at most,
+ *          and the most blocks held at once.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "system_proc.h"
+
+#define NUM_PROCS 16
+#define MAX_PROCS (NUM_PROCS + 8)
+#define SLAB_LARGE_COUNT_OLD 2
+#define SLAB_LARGE_COUNT_NEW 6      /* keep in sync with src/k_memory.h */
+#define BYTE_US (1000000.0 / 11520)  /* 115200 baud, 10 bits a byte */
+
+typedef struct {
+	int mtype;
+	char mtext[TOP_TEXT_SIZE];
+} MSG_BUF;
+
+/* ----- the 512 byte class ----- */
+static MSG_BUF g_pool[SLAB_LARGE_COUNT_NEW];
+static int g_pool_used[SLAB_LARGE_COUNT_NEW];
+static int g_pool_count;
+static int g_in_use;
+static int g_in_use_max;
+
+/* ----- CRT ring and the blocks forwarded to the UART i-process ----- */
+static char g_ring[CRT_RING_SIZE];
+static unsigned int g_ring_head, g_ring_tail;
+static MSG_BUF *g_fwd[SLAB_LARGE_COUNT_NEW];
+static int g_fwd_head, g_fwd_num, g_tx_pos;
+
+/* ----- KCD, resumed where it waited for a block ----- */
+static int g_lines;             /* processes in the table */
+static int g_kcd_line;          /* next table line, -1 while idle */
+static MSG_BUF *g_kcd_msg;
+static int g_kcd_len;
+static int g_kcd_waiting;
+
+static MSG_BUF *request_memory(void) {
+	int i;
+
+	for (i = 0; i < g_pool_count; i++) {
+		if (!g_pool_used[i]) {
+			g_pool_used[i] = 1;
+			if (++g_in_use > g_in_use_max) {
+				g_in_use_max = g_in_use;
+			}
+			return &g_pool[i];
+		}
+	}
+	return NULL;
+}
+
+static void release_memory_block(MSG_BUF *msg) {
+	g_pool_used[msg - g_pool] = 0;
+	g_in_use--;
+}
+
+/* CRT, copy into the ring or forward to the UART i-process */
+static void send_message(MSG_BUF *msg) {
+	unsigned int len = strlen(msg->mtext);
+	unsigned int i;
+
+	if (g_fwd_num == 0 && g_ring_head - g_ring_tail + len <= CRT_RING_SIZE) {
+		for (i = 0; i < len; i++) {
+			g_ring[(g_ring_head + i) & CRT_RING_MASK] = msg->mtext[i];
+		}
+		g_ring_head += len;
+		release_memory_block(msg);
+	} else {
+		g_fwd[(g_fwd_head + g_fwd_num++) % SLAB_LARGE_COUNT_NEW] = msg;
+	}
+}
+
+/* one byte time of the UART i-process, the ring before forwarded blocks */
+static void uart_byte(void) {
+	MSG_BUF *msg;
+
+	if (g_ring_tail != g_ring_head) {
+		g_ring_tail++;
+	} else if (g_fwd_num > 0) {
+		msg = g_fwd[g_fwd_head];
+		g_tx_pos++;
+		if (msg->mtext[g_tx_pos] == '\0') {
+			release_memory_block(msg);
+			g_fwd_head = (g_fwd_head + 1) % SLAB_LARGE_COUNT_NEW;
+			g_fwd_num--;
+			g_tx_pos = 0;
+		}
+	}
+}
+
+/* ----- copied from src/system_proc.c, request_memory can fail here ----- */
+static int kcd_top_line(MSG_BUF **p_msg, int *p_len, char *line) {
+	int len = strlen(line);
+
+	if (*p_msg != NULL && *p_len + len >= TOP_TEXT_SIZE) {
+		send_message(*p_msg);
+		*p_msg = NULL;
+	}
+	if (*p_msg == NULL) {
+		*p_msg = request_memory();
+		if (*p_msg == NULL) {
+			return 0;       /* KCD is blocked, the line is tried again */
+		}
+		(*p_msg)->mtype = 0;
+		*p_len = 0;
+	}
+	strcpy((*p_msg)->mtext + *p_len, line);
+	*p_len += len;
+	return 1;
+}
+
+/* lines from g_kcd_line on, 0 if KCD blocked on the pool */
+static int kcd_top(void) {
+	char line[TOP_LINE_SIZE];
+
+	for (; g_kcd_line <= g_lines; g_kcd_line++) {
+		if (g_kcd_line == 0) {
+			strcpy(line, "\r\npid pri state  cpu%   run ms   vol   inv  mem ms recv ms  sent  recv miss  blk\r\n");
+		} else {
+			sprintf(line, "%3d %3d %5s %3d.%d %8u %5u %5u %7u %7u %5u %5u %4u %4u\r\n",
+				g_kcd_line - 1, 1, "RDY", 12, 5, 123456u, 1234u, 567u, 89u, 12345u, 678u, 678u, 0u, 3u);
+		}
+		if (!kcd_top_line(&g_kcd_msg, &g_kcd_len, line)) {
+			return 0;
+		}
+	}
+	send_message(g_kcd_msg);
+	g_kcd_msg = NULL;
+	g_kcd_line = -1;
+	return 1;
+}
+/* ----- end of the copy ----- */
+
+static void run(int pool, int lines, int seconds) {
+	long bytes = (long)(seconds * 1000000.0 / BYTE_US);
+	long period = (long)(TOP_PERIOD * 1000.0 / BYTE_US);
+	long blocked = 0;
+	long wait = 0;
+	long wait_max = 0;
+	long waited = 0;
+	long refreshes = 0;
+	long late = 0;
+	long t;
+
+	memset(g_pool_used, 0, sizeof(g_pool_used));
+	g_pool_count = pool;
+	g_in_use = g_in_use_max = 0;
+	g_ring_head = g_ring_tail = 0;
+	g_fwd_head = g_fwd_num = g_tx_pos = 0;
+	g_lines = lines;
+	g_kcd_line = -1;
+	g_kcd_msg = NULL;
+	g_kcd_waiting = 0;
+
+	for (t = 0; t < bytes; t++) {
+		if (t % period == 0) {
+			if (g_kcd_line != -1) {
+				late++;     /* still on the last table */
+			} else {
+				g_kcd_line = 0;
+				refreshes++;
+			}
+		}
+		if (g_kcd_line != -1) {
+			if (kcd_top()) {
+				g_kcd_waiting = 0;
+			} else if (!g_kcd_waiting) {
+				g_kcd_waiting = 1;
+				blocked++;
+				waited = 0;
+			}
+		}
+		if (g_kcd_waiting) {
+			wait++;
+			if (++waited > wait_max) {
+				wait_max = waited;
+			}
+		}
+		uart_byte();
+	}
+
+	printf("%5d %6d %10ld %8ld %9.1f %8.1f %6ld %6d\n", pool, lines, refreshes, blocked,
+		wait * BYTE_US / 1000, wait_max * BYTE_US / 1000, late, g_in_use_max);
+}
+
+int main(int argc, char **argv) {
+	int seconds = argc > 1 ? atoi(argv[1]) : 600;
+
+	printf("%5s %6s %10s %8s %9s %8s %6s %6s\n", "pool", "lines", "refreshes",
+		"blocked", "wait ms", "max ms", "late", "held");
+	run(SLAB_LARGE_COUNT_OLD, NUM_PROCS, seconds);
+	run(SLAB_LARGE_COUNT_OLD, MAX_PROCS, seconds);
+	run(SLAB_LARGE_COUNT_NEW, NUM_PROCS, seconds);
+	run(SLAB_LARGE_COUNT_NEW, MAX_PROCS, seconds);
+	return 0;
+}
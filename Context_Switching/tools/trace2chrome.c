@@ -0,0 +1,149 @@
+/**
+ * @file:   trace2chrome.c
+ * @brief:  host side converter of a %DT trace dump into Chrome trace JSON,
+ *          to be opened in chrome://tracing or ui.perfetto.dev.
+ *              cc -I../src -o trace2chrome trace2chrome.c
+ *              ./trace2chrome < console.bin > trace.json
+ *          The input is a raw capture of the serial console, the dump is found
+ *          by its "@TRACE" header. Each process is a thread, the time it runs
+ *          is a slice, everything else is an instant event on its thread.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "k_trace.h"
+
+#define EVENT_SIZE 12
+
+/* pids of k_rtx.h, then the MAX_DYN_PROCS pids of create_process */
+static const char *g_names[] = {
+	"null", "P1", "P2", "P3", "P4", "P5", "P6", "A", "B", "C",
+	"set_prio", "clock", "KCD", "CRT", "timer_iproc", "uart_iproc",
+	"dyn16", "dyn17", "dyn18", "dyn19", "dyn20", "dyn21", "dyn22", "dyn23"
+};
+#define NUM_NAMES (sizeof(g_names) / sizeof(g_names[0]))
+
+/* PROC_STATE_E of k_rtx.h */
+static const char *g_states[] = {
+	"NEW", "RDY", "RUN", "BLOCKED", "BLOCKED_ON_RECEIVE", "BLOCKED_ON_REPLY", "EXITED", "WAIT_PERIOD"
+};
+#define NUM_STATES (sizeof(g_states) / sizeof(g_states[0]))
+
+static uint32_t get_u32(const unsigned char *p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static const char *name(unsigned int pid) {
+	static char buf[16];
+	if (pid < NUM_NAMES) {
+		return g_names[pid];
+	}
+	sprintf(buf, "pid %u", pid);
+	return buf;
+}
+
+static int g_first = 1;
+
+static void emit(const char *ph, const char *ev, unsigned int tid, double us, const char *args) {
+	printf("%s\n  {\"name\": \"%s\", \"ph\": \"%s\", \"ts\": %.3f, \"pid\": 1, \"tid\": %u%s%s}",
+		g_first ? "" : ",", ev, ph, us, tid, args[0] ? ", " : "", args);
+	g_first = 0;
+}
+
+int main(void) {
+	static unsigned char buf[1 << 20];
+	size_t len = fread(buf, 1, sizeof(buf), stdin);
+	unsigned char *p = NULL;
+	unsigned char *it;
+	uint32_t count, ticks_per_ms, i;
+	int running = -1;
+	double last_us = 0;
+	char args[64];
+	
+	// the last dump in the capture wins
+	for (it = buf; it + 6 <= buf + len; it++) {
+		if (memcmp(it, "@TRACE", 6) == 0) {
+			p = it;
+		}
+	}
+	if (p == NULL || p + 14 > buf + len) {
+		fprintf(stderr, "no trace dump found\n");
+		return 1;
+	}
+	count = get_u32(p + 6);
+	ticks_per_ms = get_u32(p + 10);
+	p += 14;
+	if (ticks_per_ms == 0 || p + (size_t)count * EVENT_SIZE > buf + len) {
+		fprintf(stderr, "trace dump is truncated\n");
+		return 1;
+	}
+	
+	printf("{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+	for (i = 0; i < NUM_NAMES; i++) {
+		printf("%s\n  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u, \"args\": {\"name\": \"%s\"}}",
+			g_first ? "" : ",", i, g_names[i]);
+		g_first = 0;
+	}
+	
+	for (i = 0; i < count; i++, p += EVENT_SIZE) {
+		uint32_t ms = get_u32(p);
+		uint32_t ticks = get_u32(p + 4);
+		unsigned int type = p[8];
+		unsigned int pid = p[9];
+		unsigned int arg = p[10] | (p[11] << 8);
+		double us = ms * 1000.0 + ticks * 1000.0 / ticks_per_ms;
+		
+		last_us = us;
+		args[0] = '\0';
+		switch (type) {
+		case TRACE_SWITCH:
+			if (running >= 0) {
+				emit("E", name(running), running, us, "");
+			} else {
+				emit("E", name(arg), arg, us, "");
+			}
+			emit("B", name(pid), pid, us, "");
+			running = pid;
+			break;
+		case TRACE_BLOCK:
+			sprintf(args, "\"args\": {\"state\": \"%s\"}", arg < NUM_STATES ? g_states[arg] : "?");
+			emit("i", "block", pid, us, args);
+			break;
+		case TRACE_UNBLOCK:
+			emit("i", "unblock", pid, us, "");
+			break;
+		case TRACE_SEND:
+			sprintf(args, "\"args\": {\"to\": \"%s\"}", name(arg));
+			emit("i", "send", pid, us, args);
+			break;
+		case TRACE_RECV:
+			sprintf(args, "\"args\": {\"from\": \"%s\"}", name(arg));
+			emit("i", "receive", pid, us, args);
+			break;
+		case TRACE_ALLOC:
+			sprintf(args, "\"args\": {\"block\": %u}", arg);
+			emit("i", "alloc", pid, us, args);
+			break;
+		case TRACE_FREE:
+			sprintf(args, "\"args\": {\"block\": %u}", arg);
+			emit("i", "free", pid, us, args);
+			break;
+		case TRACE_IRQ_ENTER:
+			emit("B", name(pid), pid, us, "");
+			break;
+		case TRACE_IRQ_EXIT:
+			emit("E", name(pid), pid, us, "");
+			break;
+		default:
+			fprintf(stderr, "unknown event type %u\n", type);
+			break;
+		}
+	}
+	if (running >= 0) {
+		emit("E", name(running), running, last_us, "");
+	}
+	printf("\n]}\n");
+	return 0;
+}
@@ -0,0 +1,372 @@
+/**
+ * @file:   wheel_bench.c
+ * @brief:  host side benchmark of the delayed_send timers, the old sorted
+ *          list against the timing wheel of kernel_procs.c, for a growing
+ *          number of outstanding messages:
+ *              cc -O2 -o wheel_bench wheel_bench.c
+ *              ./wheel_bench
+ *          Both are copies of the kernel code, the message only keeps the
+ *          fields they use. Every tick runs like timer_i_process: the messages
+ *          sent on the last tick are inserted, then the due ones expire. An
+ *          expired message is sent again with a new random delay, so the number
+ *          outstanding stays the same. Most delays are under a second, some
+ *          reach level 1 and 2 of the wheel.
+ *
+ *          It gives the mean time of a tick, and counts the list nodes or
+ *          messages touched per insert and per tick. The worst tick is given in
+ *          those steps since host timings of single ticks are noise. Every
+ *          message must expire on the tick of its deadline, and messages with
+ *          the same deadline in the order they were sent. The benchmark stops
+ *          if the wheel breaks either, for the old list FIFO breaks are counted.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+typedef uint32_t U32;
+
+#define WHEEL0_BITS 8
+#define WHEEL0_SIZE (1 << WHEEL0_BITS)
+#define WHEELN_BITS 6
+#define WHEELN_SIZE (1 << WHEELN_BITS)
+
+#define MAX_N 1000
+#define TICKS 300000
+
+typedef struct msg_t {
+	struct msg_t *next;
+	int delay;          /* absolute expiry once inserted, like the kernel */
+	U32 seq;            /* order it was sent in */
+} MSG_T;
+
+typedef struct timer_slot {
+	MSG_T *head;
+	MSG_T *tail;
+} TIMER_SLOT;
+
+static MSG_T g_msgs[MAX_N];
+static U32 g_timer_count;
+static U32 g_seq;
+static U32 g_steps;            /* nodes or messages touched in the current tick */
+
+/* messages sent on the last tick, inserted on this one like the timer mailbox */
+static MSG_T *g_sent[MAX_N];
+static int g_num_sent;
+
+/* checks, every expired message goes through expired() */
+static long g_late;
+static long g_fifo;
+static U32 g_last_deadline;
+static U32 g_last_seq;
+
+static int random_delay(void) {
+	int r = rand() % 100;
+
+	if (r < 90) {
+		return 1 + rand() % 1000;
+	} else if (r < 99) {
+		return 1 + rand() % 60000;
+	}
+	return 60000 + rand() % 140000;
+}
+
+static void send_delayed(MSG_T *msg) {
+	msg->delay = random_delay();
+	msg->seq = g_seq++;
+	g_sent[g_num_sent++] = msg;
+}
+
+static void expired(MSG_T *msg) {
+	if ((U32)msg->delay != g_timer_count) {
+		g_late++;
+	}
+	if ((U32)msg->delay == g_last_deadline && msg->seq < g_last_seq) {
+		g_fifo++;
+	}
+	g_last_deadline = msg->delay;
+	g_last_seq = msg->seq;
+	send_delayed(msg);
+}
+
+/* ----- old: one list sorted by deadline ----- */
+static MSG_T *timer_head = NULL;
+static MSG_T *timer_tail = NULL;
+
+static void list_insert(MSG_T *msg_t) {
+	MSG_T *it = timer_head;
+
+	msg_t->next = NULL;
+
+	if (NULL == timer_head) {
+		timer_head = msg_t;
+		timer_tail = msg_t;
+	} else if (msg_t->delay < timer_head->delay) {
+		msg_t->next = timer_head;
+		timer_head = msg_t;
+	} else {
+		while (it->next && it->next->delay < msg_t->delay) {
+			it = it->next;
+			g_steps++;
+		}
+		msg_t->next = it->next;
+		it->next = msg_t;
+
+		if (it->next == NULL) {
+			timer_tail = it;
+		}
+	}
+	g_steps++;
+}
+
+static void list_expire(void) {
+	MSG_T *node = timer_head;
+
+	while (node && (U32)node->delay <= g_timer_count) {
+		MSG_T *next = node->next;
+		g_steps++;
+		expired(node);
+		node = next;
+	}
+	timer_head = node;
+}
+
+/* ----- new: timing wheel ----- */
+static TIMER_SLOT g_wheel0[WHEEL0_SIZE];
+static TIMER_SLOT g_wheel1[WHEELN_SIZE];
+static TIMER_SLOT g_wheel2[WHEELN_SIZE];
+static TIMER_SLOT g_wheel_overflow;
+static U32 g_wheel_time = 0;
+static int g_wheel_pending = 0;
+
+static TIMER_SLOT *wheel_slot(U32 expires) {
+	U32 diff;
+
+	if ((int)(expires - g_wheel_time) < 0) {
+		expires = g_wheel_time;
+	}
+	diff = expires - g_wheel_time;
+
+	if (diff < WHEEL0_SIZE) {
+		return &g_wheel0[expires & (WHEEL0_SIZE - 1)];
+	} else if (diff < (WHEEL0_SIZE << WHEELN_BITS)) {
+		return &g_wheel1[(expires >> WHEEL0_BITS) & (WHEELN_SIZE - 1)];
+	} else if (diff < (WHEEL0_SIZE << (2 * WHEELN_BITS))) {
+		return &g_wheel2[(expires >> (WHEEL0_BITS + WHEELN_BITS)) & (WHEELN_SIZE - 1)];
+	}
+	return &g_wheel_overflow;
+}
+
+static void wheel_add(MSG_T *msg_t) {
+	TIMER_SLOT *slot = wheel_slot((U32)msg_t->delay);
+
+	msg_t->next = NULL;
+	if (slot->tail != NULL) {
+		slot->tail->next = msg_t;
+	} else {
+		slot->head = msg_t;
+	}
+	slot->tail = msg_t;
+	g_steps++;
+}
+
+static void wheel_cascade(TIMER_SLOT *slot) {
+	MSG_T *node = slot->head;
+	MSG_T *reversed = NULL;
+
+	slot->head = NULL;
+	slot->tail = NULL;
+
+	while (node) {
+		MSG_T *next = node->next;
+		node->next = reversed;
+		reversed = node;
+		node = next;
+		g_steps++;
+	}
+
+	while (reversed) {
+		MSG_T *next = reversed->next;
+		TIMER_SLOT *target = wheel_slot((U32)reversed->delay);
+
+		reversed->next = target->head;
+		target->head = reversed;
+		if (target->tail == NULL) {
+			target->tail = reversed;
+		}
+		reversed = next;
+		g_steps++;
+	}
+}
+
+static void wheel_expire(void) {
+	MSG_T *node;
+
+	if (g_wheel_pending == 0) {
+		g_wheel_time = g_timer_count;
+	}
+
+	while ((int)(g_timer_count - g_wheel_time) >= 0) {
+		U32 index = g_wheel_time & (WHEEL0_SIZE - 1);
+
+		if (index == 0) {
+			U32 index1 = (g_wheel_time >> WHEEL0_BITS) & (WHEELN_SIZE - 1);
+			U32 index2 = (g_wheel_time >> (WHEEL0_BITS + WHEELN_BITS)) & (WHEELN_SIZE - 1);
+
+			wheel_cascade(&g_wheel1[index1]);
+			if (index1 == 0) {
+				wheel_cascade(&g_wheel2[index2]);
+				if (index2 == 0) {
+					wheel_cascade(&g_wheel_overflow);
+				}
+			}
+		}
+
+		node = g_wheel0[index].head;
+		g_wheel0[index].head = NULL;
+		g_wheel0[index].tail = NULL;
+		while (node) {
+			MSG_T *next = node->next;
+			g_steps++;
+			g_wheel_pending--;
+			expired(node);
+			node = next;
+		}
+
+		g_wheel_time++;
+	}
+}
+
+/* ----- benchmark ----- */
+typedef struct result {
+	double tick_ns;     /* per tick, inserts and expiry */
+	double ins_steps;   /* per inserted message */
+	double steps_mean;  /* per tick */
+	U32 steps_max;      /* worst tick */
+} RESULT;
+
+static double now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void reset(int n) {
+	int i;
+
+	srand(1);
+	g_timer_count = 0;
+	g_seq = 0;
+	g_num_sent = 0;
+	g_late = 0;
+	g_fifo = 0;
+	g_last_deadline = 0;
+	g_last_seq = 0;
+	timer_head = timer_tail = NULL;
+	for (i = 0; i < WHEEL0_SIZE; i++) {
+		g_wheel0[i].head = g_wheel0[i].tail = NULL;
+	}
+	for (i = 0; i < WHEELN_SIZE; i++) {
+		g_wheel1[i].head = g_wheel1[i].tail = NULL;
+		g_wheel2[i].head = g_wheel2[i].tail = NULL;
+	}
+	g_wheel_overflow.head = g_wheel_overflow.tail = NULL;
+	g_wheel_time = 0;
+	g_wheel_pending = 0;
+	for (i = 0; i < n; i++) {
+		send_delayed(&g_msgs[i]);
+	}
+}
+
+/* one tick of timer_i_process, steps of the inserts go to *p_ins_steps */
+static void tick(int wheel, long *p_inserted, double *p_ins_steps) {
+	MSG_T *batch[MAX_N];
+	int num = g_num_sent;
+	int i;
+
+	for (i = 0; i < num; i++) {
+		batch[i] = g_sent[i];
+	}
+	g_num_sent = 0;
+	g_steps = 0;
+
+	for (i = 0; i < num; i++) {
+		batch[i]->delay = batch[i]->delay + g_timer_count;
+		if (wheel) {
+			wheel_add(batch[i]);
+			g_wheel_pending++;
+		} else {
+			list_insert(batch[i]);
+		}
+	}
+	*p_inserted += num;
+	*p_ins_steps += g_steps;
+
+	if (wheel) {
+		wheel_expire();
+	} else {
+		list_expire();
+	}
+}
+
+/* the first tick inserts all n messages at once and is left out of the figures */
+static RESULT run(int n, int wheel) {
+	RESULT r = {0, 0, 0, 0};
+	double steps_total = 0;
+	long inserted = 0;
+	double t0;
+
+	reset(n);
+	g_timer_count = 1;
+	tick(wheel, &inserted, &r.ins_steps);
+	inserted = 0;
+	r.ins_steps = 0;
+
+	t0 = now_ns();
+	for (g_timer_count = 2; g_timer_count <= TICKS; g_timer_count++) {
+		tick(wheel, &inserted, &r.ins_steps);
+		steps_total += g_steps;
+		if (g_steps > r.steps_max) {
+			r.steps_max = g_steps;
+		}
+	}
+	r.tick_ns = (now_ns() - t0) / (TICKS - 1);
+	r.ins_steps = inserted ? r.ins_steps / inserted : 0;
+	r.steps_mean = steps_total / (TICKS - 1);
+	return r;
+}
+
+int main(void) {
+	static const int counts[] = {10, 30, 100, 300, 1000};
+	unsigned int i;
+
+	printf("%5s | %-35s | %-35s\n", "", "sorted list", "timing wheel");
+	printf("%5s | %8s %8s %8s %8s | %8s %8s %8s %8s\n", "n",
+		"ns/tick", "st/ins", "st/tick", "worst", "ns/tick", "st/ins", "st/tick", "worst");
+	for (i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+		RESULT l, w;
+		long list_fifo;
+
+		l = run(counts[i], 0);
+		if (g_late != 0) {
+			fprintf(stderr, "sorted list: %ld messages off their deadline with %d outstanding\n", g_late, counts[i]);
+			return 1;
+		}
+		list_fifo = g_fifo;
+		w = run(counts[i], 1);
+		if (g_late != 0 || g_fifo != 0) {
+			fprintf(stderr, "wheel: %ld messages off their deadline, %ld out of order with %d outstanding\n",
+				g_late, g_fifo, counts[i]);
+			return 1;
+		}
+		printf("%5d | %8.1f %8.2f %8.2f %8u | %8.1f %8.2f %8.2f %8u", counts[i],
+			l.tick_ns, l.ins_steps, l.steps_mean, l.steps_max,
+			w.tick_ns, w.ins_steps, w.steps_mean, w.steps_max);
+		if (list_fifo != 0) {
+			printf("   list out of order %ld", list_fifo);
+		}
+		printf("\n");
+	}
+	return 0;
+}